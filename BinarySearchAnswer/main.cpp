@@ -6,6 +6,7 @@
 #include <ctime>
 #include <string>
 #include <queue>
+#include <algorithm>
 
 #define TIME_INF 1e8
 #define SCALE_X (margin_hor + 20.f)
@@ -18,6 +19,17 @@
 #define PTR_TEXT_SIZE 25.f
 #define PTR_ARROW_LENGTH 20.f
 #define FONT_SIZE 20.f
+#define ROUTE_MAX_N 40
+#define BFS_FRAMES 16
+#define BFS_FRAME_TIME 0.05f
+
+/* Grid cell states, as palette indices; plain cells name no colour and stay transparent */
+#define CELL_PLAIN '.'
+#define CELL_OPEN '0'
+#define CELL_VISITED '1'
+#define CELL_PATH '2'
+#define CELL_START '3'
+#define CELL_END '4'
 
 const int DX[4] = { -1,0,1,0 };
 const int DY[4] = { 0,-1,0,1 };
@@ -161,6 +173,53 @@ struct D_Text {
 
 };
 
+struct D_Grid {
+
+	Json ele;
+	Json timeline;
+	std::vector<std::string> labels;
+	float label_size;
+	RGB label_col;
+
+	D_Grid(RGB color, bool fill, float width, float layer, const std::vector<RGB>& palette) {
+		ele.clear();
+		ele["type"] = "Grid";
+		ele["color"] = Json::array({ color.r, color.g, color.b });
+		ele["fill"] = fill;
+		ele["width"] = width;
+		ele["layer"] = layer;
+		ele["palette"] = Json::array();
+		for (auto& col : palette)
+			ele["palette"].push_back(Json::array({ col.r, col.g, col.b }));
+		label_size = FONT_SIZE;
+		label_col = { 255,255,255 };
+		timeline.clear();
+	}
+
+	void drawFrame(float time, std::string mix_mode, float x, float y, float w, float h, int rows, int cols, const std::string& cells) {
+		Json f;
+		f["ts"] = time;
+		f["mix_mode"] = mix_mode;
+		f["pos"] = Json::array({ x - w / 2,y - h / 2 });
+		f["siz"] = Json::array({ w,h });
+		f["rows"] = rows;
+		f["cols"] = cols;
+		f["cells"] = cells;
+		if (!labels.empty()) {
+			f["labels"] = labels;
+			f["label_size"] = label_size;
+			f["label_color"] = Json::array({ label_col.r,label_col.g,label_col.b });
+		}
+		timeline.push_back(f);
+	}
+
+	void flush(Json &ele_list) {
+		ele["frame"] = timeline;
+		ele_list.push_back(ele);
+	}
+
+};
+
 struct Arrow {
 
 	float m_x, m_y, m_l;
@@ -196,11 +255,14 @@ float win_width, win_height;
 float base_width, base_height;
 float margin_hor, margin_ver;
 float grid_len;
+float grid_x, grid_y;
 int n;
+bool show_routes;
 int s_x, s_y, e_x, e_y;
 int max_value;
 std::vector<std::vector<int>> mat;
-std::vector<std::vector<D_Rect*>> hlg;
+D_Grid* grid;
+std::string cells;
 std::vector<std::vector<std::pair<int, int>>> coo;
 std::vector<std::vector<bool>> vis;
 std::vector<std::vector<int>> from;
@@ -253,11 +315,13 @@ struct Route {
 
 std::unordered_map<int, std::unordered_map<int, std::unordered_map<int, Route*>>> rt;
 
-void InitPara() {
+void InitPara(int size) {
 	win_width = 1920.f; win_height = 1080.f;
 	base_width = 1900.f; base_height = 1000.f;
 	margin_hor = (win_width - base_width) / 2; margin_ver = (win_height - base_height) / 2;
-	n = 20;
+	n = std::max(size, 4);
+	/* Routes between cells are only drawn while cells are large enough to show them */
+	show_routes = n <= ROUTE_MAX_N;
 	max_value = 500;
 	s_x = rand() % n; s_y = rand() % n;
 	while (s_x == 0 || s_x == n - 1 || s_y == 0 || s_y == n - 1) {
@@ -271,13 +335,11 @@ void InitPara() {
 
 void InitMatrix() {
 	mat = std::vector<std::vector<int>>(n);
-	hlg = std::vector<std::vector<D_Rect*>>(n);
 	coo = std::vector<std::vector<std::pair<int, int>>>(n);
 	vis = std::vector<std::vector<bool>>(n);
 	from = std::vector<std::vector<int>>(n);
 	for (int i = 0; i < n; i++) {
 		mat[i] = std::vector<int>(n);
-		hlg[i] = std::vector<D_Rect*>(n);
 		coo[i] = std::vector<std::pair<int, int>>(n);
 		vis[i] = std::vector<bool>(n);
 		from[i] = std::vector<int>(n);
@@ -310,44 +372,62 @@ void InitBasic() {
 	}
 
 	/* Grid */
-	D_Rect* r;
-	D_Text* txt;
 	float len = 0.95f * base_height;
 	grid_len = len / n;
 	float sx = win_width - margin_hor - len;
 	float sy = (win_height - len) / 2;
+	grid_x = sx + len / 2;
+	grid_y = sy + len / 2;
 	for(int i = 0; i < n; i++)
 		for (int j = 0; j < n; j++) {
 			float x = sx + j * grid_len;
 			float y = sy + i * grid_len;
-			float appear_time = 0.1f + (0.6f - 0.1f) / (n * n) * (i * n + j);
 			coo[i][j] = std::make_pair(x + grid_len / 2, y + grid_len / 2);
+			if (!show_routes)
+				continue;
 			for (int k = 0; k < 4; k++) {
 				int nx = i + DX[k], ny = j + DY[k];
 				if (nx < 0 || nx >= n || ny < 0 || ny >= n)
 					continue;
 				rt[i][j][k] = new Route(x + grid_len / 2, y + grid_len / 2, x + grid_len / 2 + DY[k] * grid_len, y + grid_len / 2 + DX[k] * grid_len, 3.f);
 			}
-			if(i == s_x && j == s_y)
-				r = new D_Rect({ 0,0,240 }, true, 8.f, 1.f - 0.0001f);
-			else if(i==e_x&&j==e_y)
-				r = new D_Rect({ 240,0,0 }, true, 8.f, 1.f - 0.0001f);
-			else
-				r = new D_Rect({ 240,240,240 }, false, 5.f, 1.f);
-			r->drawFrame(0.f, "smoothstep", x + grid_len / 2, -100.f, grid_len, grid_len);
-			r->drawFrame(appear_time, "smoothstep", x + grid_len / 2, y + grid_len / 2, grid_len, grid_len);
-			r->drawFrame(TIME_INF, "smoothstep", x + grid_len / 2, y + grid_len / 2, grid_len, grid_len);
-			r->flush(ele_list);
-			hlg[i][j] = new D_Rect({ 52,177,71 }, true, 1.f, 1 - 0.0002f);
-			txt = new D_Text({ 200,200,200 }, 1 - 0.0003f);
-			txt->drawFrame(appear_time, "steep", std::to_string(mat[i][j]), x + grid_len / 2, y + grid_len / 2 + 10.f, FONT_SIZE);
-			txt->drawFrame(TIME_INF, "steep", "", x + grid_len / 2, y + grid_len / 2 + 10.f, FONT_SIZE);
-			txt->flush(ele_list);
-			delete txt;
 		}
+	cells = std::string(n * n, CELL_PLAIN);
+	cells[s_x * n + s_y] = CELL_START;
+	cells[e_x * n + e_y] = CELL_END;
+	grid = new D_Grid({ 240,240,240 }, grid_len < 8.f, std::min(5.f, grid_len / 8.f), 1.f,
+		{ { 52,177,71 }, { 252,248,61 }, { 255,0,0 }, { 0,0,240 }, { 240,0,0 } });
+	if (show_routes) {
+		for (int i = 0; i < n; i++)
+			for (int j = 0; j < n; j++)
+				grid->labels.push_back(std::to_string(mat[i][j]));
+		grid->label_size = std::min(FONT_SIZE, grid_len * 0.45f);
+		grid->label_col = { 200,200,200 };
+	}
+	/* Rows fly in one after another and show their labels once they land; the whole grid takes over at 0.6 */
+	for (int i = 0; i < n; i++) {
+		D_Grid row = *grid;
+		float y = sy + i * grid_len + grid_len / 2;
+		float appear_time = 0.1f + (0.6f - 0.1f) / n * (i + 1);
+		std::string row_cells = cells.substr(i * n, n);
+		if (show_routes)
+			row.labels = std::vector<std::string>(n);
+		row.drawFrame(0.f, "smoothstep", grid_x, -100.f, len, grid_len, 1, n, row_cells);
+		if (show_routes)
+			row.labels.assign(grid->labels.begin() + i * n, grid->labels.begin() + (i + 1) * n);
+		row.drawFrame(appear_time, "smoothstep", grid_x, y, len, grid_len, 1, n, row_cells);
+		if (i + 1 < n)
+			row.drawFrame(0.6f, "smoothstep", grid_x, y, len, grid_len, 1, n, row_cells);
+		row.flush(ele_list);
+	}
+	grid->drawFrame(0.6f, "steep", grid_x, grid_y, len, len, n, n, cells);
 	timer = 1.f;
 }
 
+void ShowCells(float time) {
+	grid->drawFrame(time, "steep", grid_x, grid_y, grid_len * n, grid_len * n, n, n, cells);
+}
+
 bool Check(int thr) {
 	/* Mark available square */
 	timer += 0.2f;
@@ -355,15 +435,16 @@ bool Check(int thr) {
 		for (int j = 0; j < n; j++) {
 			vis[i][j] = false;
 			from[i][j] = 0;
-			if (mat[i][j] >= thr) {
-				hlg[i][j]->drawFrame(timer, "steep", coo[i][j].first, coo[i][j].second, grid_len, grid_len);
-			}
+			if (mat[i][j] >= thr && cells[i * n + j] == CELL_PLAIN)
+				cells[i * n + j] = CELL_OPEN;
 		}
+	ShowCells(timer);
 	timer += 0.2f;
 	/* Search */
 	bool success = false;
 	std::queue<std::pair<int, int>> q;
 	std::vector<Route*> path;
+	int visited = 0, batch = std::max(1, n * n / BFS_FRAMES);
 	vis[s_x][s_y] = true;
 	q.push(std::make_pair(s_x, s_y));
 	while (!q.empty() && !success) {
@@ -376,10 +457,30 @@ bool Check(int thr) {
 				continue;
 			vis[nx][ny] = true;
 			q.push(std::make_pair(nx, ny));
-			timer += 0.002f;
-			rt[x][y][k]->appear(timer, { -1,-1,-1 });
+			if (show_routes) {
+				timer += 0.002f;
+				rt[x][y][k]->appear(timer, { -1,-1,-1 });
+			}
+			else {
+				if (cells[nx * n + ny] == CELL_OPEN)
+					cells[nx * n + ny] = CELL_VISITED;
+				if (++visited % batch == 0) {
+					timer += BFS_FRAME_TIME;
+					ShowCells(timer);
+				}
+			}
 			from[nx][ny] = (k + 2) % 4;
-			if (nx == e_x && ny == e_y) {
+			if (nx == e_x && ny == e_y && !show_routes) {
+				for (int ux = e_x, uy = e_y; !(ux == s_x && uy == s_y);) {
+					int d = from[ux][uy];
+					ux += DX[d];
+					uy += DY[d];
+					if (cells[ux * n + uy] == CELL_VISITED)
+						cells[ux * n + uy] = CELL_PATH;
+				}
+				success = true;
+			}
+			else if (nx == e_x && ny == e_y) {
 				timer -= 0.002f;
 				for (int ux = e_x, uy = e_y; !(ux == s_x && uy == s_y);) {
 					int d = from[ux][uy];
@@ -400,15 +501,21 @@ bool Check(int thr) {
 			}
 		}
 	}
+	if (!show_routes) {
+		timer += BFS_FRAME_TIME;
+		ShowCells(timer);
+	}
 	timer += 0.5f;
 	for (int i = 0; i < n; i++)
-		for (int j = 0; j < n; j++)
-			for (int k = 0; k < 4; k++) {
-				if (rt[i][j][k] != nullptr && rt[i][j][k]->active)
-					rt[i][j][k]->disappear(timer);
-				if (mat[i][j] >= thr) 
-					hlg[i][j]->drawFrame(timer, "steep", -100.f, -100.f, 0, 0);
-			}
+		for (int j = 0; j < n; j++) {
+			if (show_routes)
+				for (int k = 0; k < 4; k++)
+					if (rt[i][j][k] != nullptr && rt[i][j][k]->active)
+						rt[i][j][k]->disappear(timer);
+			if (cells[i * n + j] != CELL_START && cells[i * n + j] != CELL_END)
+				cells[i * n + j] = CELL_PLAIN;
+		}
+	ShowCells(timer);
 	for (auto& x : path) {
 		x->disappear(timer);
 		x->flush(ele_list);
@@ -444,13 +551,14 @@ void BinarySearchAnswer() {
 	arrow_l.flush(ele_list);
 	arrow_r.flush(ele_list);
 	arrow_m.flush(ele_list);
-	for (int i = 0; i < n; i++)
-		for (int j = 0; j < n; j++) {
-			hlg[i][j]->flush(ele_list);
-			for (int k = 0; k < 4; k++)
-				if (rt[i][j][k] != nullptr)
-					rt[i][j][k]->flush(ele_list);
-		}
+	grid->drawFrame(TIME_INF, "steep", grid_x, grid_y, grid_len * n, grid_len * n, n, n, cells);
+	grid->flush(ele_list);
+	if (show_routes)
+		for (int i = 0; i < n; i++)
+			for (int j = 0; j < n; j++)
+				for (int k = 0; k < 4; k++)
+					if (rt[i][j][k] != nullptr)
+						rt[i][j][k]->flush(ele_list);
 }
 
 void Output() {
@@ -462,9 +570,9 @@ void Output() {
 	out << data;
 }
 
-int main() {
+int main(int argc, char** argv) {
 	srand(time(NULL));
-	InitPara();
+	InitPara(argc > 1 ? atoi(argv[1]) : 20);
 	InitMatrix();
 	InitBasic();
 	BinarySearchAnswer();
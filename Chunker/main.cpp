@@ -0,0 +1,142 @@
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#pragma warning(push,0)
+#include <cxxopts.hpp>
+#pragma warning(pop)
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using Json = nlohmann::json;
+
+float timeStamp(const Json &frame) {
+    return frame["ts"].get<float>();
+}
+
+// A drawable with its keyframes, and those of its children, sorted by time.
+struct Source final {
+    const Json *drawable;
+    std::vector<Json> frames;
+    std::vector<Source> children;
+};
+
+bool loadSource(const Json &drawable, Source &src) {
+    src.drawable = &drawable;
+    if (!drawable.count("frame"))
+        return false;
+    for (auto &&frame : drawable["frame"])
+        src.frames.push_back(frame);
+    if (src.frames.empty())
+        return false;
+    std::stable_sort(src.frames.begin(), src.frames.end(), [] (const Json &lhs, const Json &rhs) {
+        return timeStamp(lhs) < timeStamp(rhs);
+        });
+    if (drawable.count("children")) {
+        for (auto &&child : drawable["children"]) {
+            Source sub;
+            if (loadSource(child, sub))
+                src.children.push_back(std::move(sub));
+        }
+    }
+    return true;
+}
+
+// A drawable is visible at ct iff its first keyframe is before ct and its last one is not.
+bool visible(const Source &src, float beg, float end) {
+    return timeStamp(src.frames.front()) < end && timeStamp(src.frames.back()) >= beg;
+}
+
+/*
+A chunk covering [beg, end) keeps the keyframes inside the window plus one carry-in
+keyframe before it and one carry-out keyframe after it, so that every drawable can be
+interpolated exactly as in the full scene for any time inside the window. Children of a
+group are sliced to the same window.
+*/
+Json sliceDrawable(const Source &src, float beg, float end) {
+    auto &&frames = src.frames;
+    auto before = [] (const Json &frame, float ts) {return timeStamp(frame) < ts; };
+    size_t i = std::lower_bound(frames.cbegin(), frames.cend(), beg, before) - frames.cbegin();
+    size_t j = std::lower_bound(frames.cbegin(), frames.cend(), end, before) - frames.cbegin();
+    size_t lo = (i ? i - 1 : 0);
+    size_t hi = std::min(j, frames.size() - 1);
+
+    Json res = *src.drawable;
+    res["frame"] = Json::array();
+    for (size_t k = lo; k <= hi; ++k)
+        res["frame"].push_back(frames[k]);
+    if (res.count("children")) {
+        res["children"] = Json::array();
+        for (auto &&child : src.children)
+            if (visible(child, beg, end))
+                res["children"].push_back(sliceDrawable(child, beg, end));
+    }
+    return res;
+}
+
+int main(int argc, char **argv) {
+    cxxopts::Options options("Chunker", "Split a scene into time-windowed chunks");
+
+    options.add_options()("input", "input scene", cxxopts::value<std::string>())
+        ("output", "output manifest", cxxopts::value<std::string>()->default_value("output.chunks.json"))
+        ("window", "chunk duration in seconds", cxxopts::value<float>()->default_value("10"));
+
+    auto result = options.parse(argc, argv);
+    fs::path input = result["input"].as<std::string>();
+    fs::path output = result["output"].as<std::string>();
+    float window = result["window"].as<float>();
+    if (window <= 0.0f)
+        throw std::invalid_argument("window must be positive");
+
+    std::ifstream in(input);
+    Json json;
+    in >> json;
+
+    float endTime = json["duration"].get<float>();
+
+    std::vector<Source> sources;
+    for (auto &&drawable : json["drawables"]) {
+        Source src;
+        if (loadSource(drawable, src))
+            sources.push_back(std::move(src));
+    }
+
+    Json manifest = json;
+    manifest.erase("drawables");
+    manifest["chunks"] = Json::array();
+
+    auto stem = output.stem().string();
+    auto dir = output.parent_path();
+    size_t count = std::max<size_t>(1, static_cast<size_t>(std::ceil(endTime / window)));
+    for (size_t k = 0; k < count; ++k) {
+        float beg = window * k;
+        float end = window * (k + 1);
+
+        Json drawables = Json::array();
+        for (auto &&src : sources)
+            if (visible(src, beg, end))
+                drawables.push_back(sliceDrawable(src, beg, end));
+
+        auto name = stem + "." + std::to_string(k) + ".json";
+        Json chunk;
+        chunk["drawables"] = std::move(drawables);
+        std::ofstream out(dir / name);
+        out << chunk;
+
+        Json desc;
+        desc["begin"] = beg;
+        desc["end"] = end;
+        desc["file"] = name;
+        manifest["chunks"].push_back(desc);
+
+        std::cout << name << ": [" << beg << ", " << end << ") " << chunk["drawables"].size() << " drawables" << std::endl;
+    }
+
+    std::ofstream out(output);
+    out << manifest;
+    return 0;
+}
@@ -15,8 +15,8 @@ struct Point final {
     glm::vec2 pos;
     float angle;
     bool inStack;
-    size_t id;
-    Json pkf, tkf;
+    size_t id, slot;
+    Json tkf;
 };
 
 struct Edge final {
@@ -26,22 +26,37 @@ struct Edge final {
 };
 
 void initPoint(Point &point) {
-    point.pkf["type"] = "Circle";
-    point.pkf["fill"] = true;
-    point.pkf["color"] = Json::array({ 255, 255, 255 });
-
     point.tkf["type"] = "Text";
     point.tkf["fill"] = true;
     point.tkf["color"] = Json::array({ 255, 255, 255 });
 }
 
-void recordPoint(Point &point, float ts) {
+Json genPoints() {
+    Json json;
+    json["type"] = "CircleArray";
+    json["fill"] = true;
+    json["color"] = Json::array({ 255, 255, 255 });
+    json["frame"] = Json::array();
+    return json;
+}
+
+// All points in one keyframe, each at its slot; a later record at the same time replaces the earlier one.
+void recordPoints(Json &circles, const std::vector<Point> &points, float ts) {
+    std::vector<float> center(points.size() * 2), radius(points.size());
+    for (auto &&point : points) {
+        center[point.slot * 2] = point.pos.x;
+        center[point.slot * 2 + 1] = height - point.pos.y;
+        radius[point.slot] = (point.inStack ? 5.0f : 3.0f);
+    }
     Json pk;
-    pk["center"] = Json::array({ point.pos.x, height - point.pos.y });
-    pk["radius"] = (point.inStack ? 5.0f : 3.0f);
+    pk["center"] = center;
+    pk["radius"] = radius;
     pk["ts"] = ts;
     pk["mix_mode"] = "steep";
-    point.pkf["frame"].push_back(pk);
+    auto &&frames = circles["frame"];
+    if (!frames.empty() && frames.back()["ts"].get<float>() == ts)
+        frames.back() = pk;
+    else frames.push_back(pk);
 }
 
 void recordPointText(Point &point, float ts) {
@@ -132,12 +147,13 @@ std::pair<float, Json> run() {
         if (!flag)break;
     }
 
+    Json circles = genPoints();
     for (size_t i = 0; i < points.size(); ++i) {
-        points[i].id = i;
+        points[i].id = points[i].slot = i;
         initPoint(points[i]);
-        recordPoint(points[i], 0.0f);
         recordPointText(points[i], 0.0f);
     }
+    recordPoints(circles, points, 0.0f);
 
     std::sort(points.begin(), points.end(), [] (const Point &lhs, const Point &rhs) {return lhs.pos.y == rhs.pos.y ? lhs.pos.x < rhs.pos.x : lhs.pos.y < rhs.pos.y; });
     std::stack<Edge> edges;
@@ -145,7 +161,7 @@ std::pair<float, Json> run() {
 
     stack.push_back(0);
     points[0].inStack = true;
-    recordPoint(points[0], 1.0f);
+    recordPoints(circles, points, 1.0f);
 
     Json drawables;
 
@@ -166,7 +182,7 @@ std::pair<float, Json> run() {
     for (size_t i = 1; i < points.size(); ++i) {
         while (stack.size() >= 2 && test(drawables, stack, points, i, dur)) {
             points[stack.back()].inStack = false;
-            recordPoint(points[stack.back()], dur);
+            recordPoints(circles, points, dur);
             stack.pop_back();
 
             auto &&edge = edges.top();
@@ -176,7 +192,7 @@ std::pair<float, Json> run() {
 
         dur += step;
         points[i].inStack = true;
-        recordPoint(points[i], dur);
+        recordPoints(circles, points, dur);
 
         edges.push(Edge{ points[stack.back()].pos, points[i].pos, dur });
         stack.push_back(i);
@@ -188,15 +204,13 @@ std::pair<float, Json> run() {
     }
 
     dur += 2.0f;
-    for (auto &&p : points) {
-        recordPoint(p, dur);
+    recordPoints(circles, points, dur);
+    for (auto &&p : points)
         recordPointText(p, dur);
-    }
 
-    for (auto &&p : points) {
-        drawables.push_back(p.pkf);
+    drawables.push_back(circles);
+    for (auto &&p : points)
         drawables.push_back(p.tkf);
-    }
 
     while (edges.size()) {
         auto edge = edges.top();
@@ -62,6 +62,34 @@ void recordArrow(Json &line, int i, int it, float ts) {
     line["frame"].push_back(lk);
 }
 
+// Rects of a row keep their local index; shifting the whole row is one keyframe of its Group.
+struct Row final {
+    int offset = 0;
+    Json gkf;
+    Row() {
+        gkf["type"] = "Group";
+        gkf["children"] = Json::array();
+    }
+    void add(const Rect &rect) {
+        gkf["children"].push_back(rect.tkf);
+        gkf["children"].push_back(rect.rkf);
+    }
+    void record(int off, float ts) {
+        offset = off;
+        Json gk;
+        gk["translate"] = { offset * woff, 0.0f };
+        gk["ts"] = ts;
+        gk["mix_mode"] = "smoothstep";
+        gkf["frame"].push_back(gk);
+    }
+    // Holds the row still until from, then slides it to off.
+    void move(int off, float from, float to) {
+        if (off != offset)
+            record(offset, from);
+        record(off, to);
+    }
+};
+
 std::pair<float, Json> run() {
     std::string patstr = "ABAABABABBABAAB";
 
@@ -86,6 +114,9 @@ std::pair<float, Json> run() {
         rect.val = patstr[i];
         recordRect(rect, 0.0f, true, true);
     }
+    Row compRow, patRow, scanRow;
+    compRow.record(0, 0.0f);
+    patRow.record(0, 0.0f);
 
     float dur = 0.0f;
 
@@ -107,13 +138,10 @@ std::pair<float, Json> run() {
 
     auto equal = [&] (int p, int cur) {
 
+        if (compRow.offset != cur - p)
+            compRow.move(cur - p, dur, dur + step);
         for (int k = 0; k < 2; ++k) {
             dur += step;
-            for (int i = 0; i < pat; ++i) {
-                Rect &rect = comp[i];
-                rect.idx = i + cur - p;
-                recordRect(rect, dur, true, true);
-            }
             recordArrow(arrow, cur, 1, dur);
         }
 
@@ -127,9 +155,7 @@ std::pair<float, Json> run() {
         pattern[cur].status = 0;
         recordRect(pattern[cur], dur, true, false);
         comp[p].status = 0;
-        for (int i = 0; i < pat; ++i) {
-            recordRect(comp[i], dur, true, false);
-        }
+        recordRect(comp[p], dur, true, false);
 
         return eq;
     };
@@ -162,9 +188,10 @@ std::pair<float, Json> run() {
     recordArrow(arrow, pat - 1, 1, dur);
     for (auto &&pat : comp) {
         recordRect(pat, dur, true, true);
-        drawables.push_back(pat.tkf);
-        drawables.push_back(pat.rkf);
+        compRow.add(pat);
     }
+    compRow.record(compRow.offset, dur);
+    drawables.push_back(compRow.gkf);
     dur += step;
     for (auto &&pat : pattern) {
         recordRect(pat, dur, true, false);
@@ -195,6 +222,7 @@ std::pair<float, Json> run() {
         rect.val = scan[i];
         recordRect(rect, dur, true, true);
     }
+    scanRow.record(0, dur);
 
     dur += 1.0f;
 
@@ -217,10 +245,10 @@ std::pair<float, Json> run() {
             lkf["type"] = "Line";
             lkf["color"] = { 0, 255, 0 };
         }
-        void record(int offset, float ts) {
+        void record(float ts) {
             Json lk;
-            lk["beg"] = { (beg + offset) * woff, hoff + rh + height };
-            lk["end"] = { (end + offset) * woff, hoff + rh + height };
+            lk["beg"] = { beg * woff, hoff + rh + height };
+            lk["end"] = { end * woff, hoff + rh + height };
             lk["ts"] = ts;
             lk["mix_mode"] = "smoothstep";
             lkf["frame"].push_back(lk);
@@ -229,7 +257,7 @@ std::pair<float, Json> run() {
 
     std::vector<Line> lines;
 
-    int coff = 0, lpoff = -1, lcoff = -1, lcur = -1;
+    int coff = 0;
 
     auto equal2 = [&] (int p, int cur) {
 
@@ -237,34 +265,15 @@ std::pair<float, Json> run() {
         int poff = std::min(delta, 8);
         coff = poff - delta;
 
+        if (patRow.offset != poff)
+            patRow.move(poff, dur, dur + step);
+        if (scanRow.offset != coff)
+            scanRow.move(coff, dur, dur + step);
         for (int k = 0; k < 2; ++k) {
             dur += step;
-            if (lpoff != poff) {
-                for (int i = 0; i < pat; ++i) {
-                    Rect &rect = pattern[i];
-                    rect.idx = i + poff;
-                    recordRect(rect, dur, true, true);
-                }
-                for (int i = 1; i <= pat; ++i) {
-                    Rect &rect = nxt[i];
-                    rect.idx = i - 1 + poff;
-                    recordRect(rect, dur, false, true);
-                }
-            }
             recordArrow(arrow, cur + coff, 1, dur);
-            if (lcoff != coff) {
-                for (int i = 0; i < num; ++i) {
-                    Rect &rect = scanStr[i];
-                    rect.idx = i + coff;
-                    recordRect(rect, dur, true, true);
-                }
-                for (auto &&l : lines)
-                    l.record(coff, dur);
-            }
         }
 
-        lpoff = poff, lcoff = coff, lcur = cur;
-
         bool eq = (patstr[p] == scan[cur]);
 
         scanStr[cur].status = (eq ? 1 : 2);
@@ -273,19 +282,9 @@ std::pair<float, Json> run() {
         recordRect(pattern[p], dur, true, false);
         dur += step;
         scanStr[cur].status = 0;
-        for (int i = 0; i < num; ++i) {
-            Rect &rect = scanStr[i];
-            recordRect(rect, dur, true, true);
-        }
+        recordRect(scanStr[cur], dur, true, true);
         pattern[p].status = 0;
-        for (int i = 0; i < pat; ++i) {
-            recordRect(pattern[i], dur, true, false);
-        }
-        for (int i = 1; i <= pat; ++i) {
-            recordRect(nxt[i], dur, false, false);
-        }
-        for (auto &&l : lines)
-            l.record(coff, dur);
+        recordRect(pattern[p], dur, true, false);
 
         return eq;
     };
@@ -303,40 +302,37 @@ std::pair<float, Json> run() {
             std::uniform_real_distribution<float> urd(2.0f, 7.0f);
             line.height = urd(eng);
             dur += step;
-            line.record(coff, dur);
+            line.record(dur);
             dur += step;
-            line.record(coff, dur);
+            line.record(dur);
             lines.push_back(line);
             p = nxt[p].val;
         }
     }
-    recordArrow(arrow, scanStr.back().idx, 1, dur);
+    recordArrow(arrow, num - 1 + coff, 1, dur);
 
+    patRow.move(0, dur, dur + 2.0f);
+    scanRow.move(0, dur, dur + 2.0f);
     dur += 2.0f;
 
     for (int i = 0; i < pat; ++i) {
-        pattern[i].idx = i;
         recordRect(pattern[i], dur, true, true);
-        drawables.push_back(pattern[i].tkf);
-        drawables.push_back(pattern[i].rkf);
+        patRow.add(pattern[i]);
     }
     for (int i = 1; i <= pat; ++i) {
-        nxt[i].idx = i - 1;
         recordRect(nxt[i], dur, false, true);
-        drawables.push_back(nxt[i].tkf);
-        drawables.push_back(nxt[i].rkf);
+        patRow.add(nxt[i]);
     }
+    drawables.push_back(patRow.gkf);
     for (int i = 0; i < num; ++i) {
-        scanStr[i].idx = i;
         recordRect(scanStr[i], dur, true, true);
-        drawables.push_back(scanStr[i].tkf);
-        drawables.push_back(scanStr[i].rkf);
+        scanRow.add(scanStr[i]);
     }
-
     for (auto &&l : lines) {
-        l.record(0, dur);
-        drawables.push_back(l.lkf);
+        l.record(dur);
+        scanRow.gkf["children"].push_back(l.lkf);
     }
+    drawables.push_back(scanRow.gkf);
 
     drawables.push_back(arrow);
 
@@ -0,0 +1,189 @@
+#include "FontMetrics.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <cstring>
+
+namespace {
+    // Big-endian reads that fail (and return 0) past the end of the file instead of throwing.
+    class Reader final {
+    private:
+        const std::vector<uint8_t> &m_data;
+    public:
+        bool ok = true;
+
+        explicit Reader(const std::vector<uint8_t> &data) :m_data(data) {}
+        uint32_t read(size_t pos, size_t bytes) {
+            if (pos + bytes > m_data.size()) {
+                ok = false;
+                return 0;
+            }
+            uint32_t res = 0;
+            for (size_t i = 0; i < bytes; ++i)
+                res = (res << 8) | m_data[pos + i];
+            return res;
+        }
+        uint16_t u16(size_t pos) {
+            return static_cast<uint16_t>(read(pos, 2));
+        }
+        int16_t i16(size_t pos) {
+            return static_cast<int16_t>(read(pos, 2));
+        }
+        uint32_t u32(size_t pos) {
+            return read(pos, 4);
+        }
+    };
+
+    // Glyph index of every code point the font maps, from a format 4 or format 12 subtable.
+    bool readCmap(Reader &in, size_t cmap, std::vector<std::pair<uint32_t, uint16_t>> &glyphs) {
+        size_t best = 0;
+        int bestRank = 0;
+        for (size_t i = 0, n = in.u16(cmap + 2); i < n && in.ok; ++i) {
+            size_t rec = cmap + 4 + i * 8;
+            auto platform = in.u16(rec), encoding = in.u16(rec + 2);
+            size_t sub = cmap + in.u32(rec + 4);
+            auto format = in.u16(sub);
+            // Full Unicode first, then the Unicode BMP.
+            int rank = 0;
+            if (format == 12 && (platform == 0 || (platform == 3 && encoding == 10)))
+                rank = 2;
+            else if (format == 4 && (platform == 0 || (platform == 3 && encoding == 1)))
+                rank = 1;
+            if (rank > bestRank)
+                best = sub, bestRank = rank;
+        }
+        if (!in.ok || !bestRank)
+            return false;
+
+        if (in.u16(best) == 12) {
+            for (size_t i = 0, n = in.u32(best + 12); i < n && in.ok; ++i) {
+                size_t group = best + 16 + i * 12;
+                uint32_t first = in.u32(group), last = in.u32(group + 4), glyph = in.u32(group + 8);
+                if (last < first || last > 0x10ffff)
+                    return false;
+                for (uint32_t cp = first; cp <= last; ++cp)
+                    glyphs.emplace_back(cp, static_cast<uint16_t>(glyph + (cp - first)));
+            }
+        }
+        else {
+            size_t segs = in.u16(best + 6) / 2;
+            size_t ends = best + 14, starts = ends + segs * 2 + 2, deltas = starts + segs * 2, offsets = deltas + segs * 2;
+            for (size_t s = 0; s < segs && in.ok; ++s) {
+                uint32_t first = in.u16(starts + s * 2), last = in.u16(ends + s * 2);
+                auto delta = in.u16(deltas + s * 2), offset = in.u16(offsets + s * 2);
+                for (uint32_t cp = first; cp <= last && cp != 0xffff; ++cp) {
+                    uint16_t glyph;
+                    if (!offset)
+                        glyph = static_cast<uint16_t>(cp + delta);
+                    else {
+                        glyph = in.u16(offsets + s * 2 + offset + (cp - first) * 2);
+                        if (glyph)
+                            glyph = static_cast<uint16_t>(glyph + delta);
+                    }
+                    if (glyph)
+                        glyphs.emplace_back(cp, glyph);
+                }
+            }
+        }
+        return in.ok;
+    }
+
+    // Next code point of UTF-8 text; stray bytes stand for themselves.
+    uint32_t decode(const unsigned char *&str) {
+        uint32_t cp = *str++;
+        size_t extra = (cp >= 0xf0 ? 3 : cp >= 0xe0 ? 2 : cp >= 0xc0 ? 1 : 0);
+        if (!extra)
+            return cp;
+        uint32_t res = cp & (0x3f >> extra);
+        for (size_t i = 0; i < extra; ++i) {
+            if ((str[i] & 0xc0) != 0x80)
+                return cp;
+            res = (res << 6) | (str[i] & 0x3f);
+        }
+        str += extra;
+        return res;
+    }
+}
+
+std::unique_ptr<FontMetrics> FontMetrics::load(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Reader in(data);
+    size_t cmap = 0, hhea = 0, hmtx = 0;
+    for (size_t i = 0, n = in.u16(4); i < n && in.ok; ++i) {
+        size_t rec = 12 + i * 16;
+        auto offset = in.u32(rec + 8);
+        if (!in.ok)
+            break;
+        if (!memcmp(&data[rec], "cmap", 4))
+            cmap = offset;
+        else if (!memcmp(&data[rec], "hhea", 4))
+            hhea = offset;
+        else if (!memcmp(&data[rec], "hmtx", 4))
+            hmtx = offset;
+    }
+    if (!in.ok || !cmap || !hhea || !hmtx)
+        return nullptr;
+
+    std::unique_ptr<FontMetrics> res(new FontMetrics());
+    int height = in.i16(hhea + 4) - in.i16(hhea + 6);
+    size_t metrics = in.u16(hhea + 34);
+    if (!in.ok || height <= 0 || !metrics)
+        return nullptr;
+    res->m_height = static_cast<uint16_t>(height);
+    // Glyphs past the last long metric share its advance.
+    auto glyphAdvance = [&] (uint16_t glyph) {
+        return in.u16(hmtx + std::min<size_t>(glyph, metrics - 1) * 4);
+    };
+    res->m_missing = glyphAdvance(0);
+
+    std::vector<std::pair<uint32_t, uint16_t>> glyphs;
+    if (!readCmap(in, cmap, glyphs))
+        return nullptr;
+    res->m_ascii.assign(128, res->m_missing);
+    for (auto &&item : glyphs) {
+        auto adv = glyphAdvance(item.second);
+        if (item.first < res->m_ascii.size())
+            res->m_ascii[item.first] = adv;
+        else res->m_advances.emplace_back(item.first, adv);
+    }
+    if (!in.ok)
+        return nullptr;
+    std::sort(res->m_advances.begin(), res->m_advances.end());
+    res->m_advances.shrink_to_fit();
+
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (auto byte : data)
+        hash = (hash ^ byte) * 0x100000001b3ull;
+    res->m_fingerprint = hash;
+    return res;
+}
+
+const FontMetrics *FontMetrics::get(const std::filesystem::path &path) {
+    static std::mutex mutex;
+    static std::map<std::filesystem::path, std::unique_ptr<FontMetrics>> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = cache.find(path);
+    if (iter == cache.cend())
+        iter = cache.emplace(path, load(path)).first;
+    return iter->second.get();
+}
+
+uint16_t FontMetrics::advance(uint32_t cp) const {
+    if (cp < m_ascii.size())
+        return m_ascii[cp];
+    auto iter = std::lower_bound(m_advances.cbegin(), m_advances.cend(), std::make_pair(cp, uint16_t(0)));
+    return iter != m_advances.cend() && iter->first == cp ? iter->second : m_missing;
+}
+
+double FontMetrics::width(const char *str, double size) const {
+    uint64_t units = 0;
+    for (auto p = reinterpret_cast<const unsigned char *>(str); *p;)
+        units += advance(decode(p));
+    return units * size / m_height;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include <filesystem>
+#include <memory>
+#include <cstdint>
+
+/*
+Horizontal metrics of a TrueType font, read once from its cmap, hhea and hmtx tables. Advances
+are kept in font units per code point: a flat table for ASCII and a sorted array for the rest.
+Widths scale linearly with the font size, so one table serves every size. Sizes follow NanoVG,
+which scales a font so that ascender - descender spans the font size.
+*/
+class FontMetrics final {
+private:
+    uint16_t m_height;
+    uint16_t m_missing;
+    uint64_t m_fingerprint;
+    std::vector<uint16_t> m_ascii;
+    std::vector<std::pair<uint32_t, uint16_t>> m_advances;
+
+    FontMetrics() = default;
+    uint16_t advance(uint32_t cp) const;
+public:
+    // Returns null if path is not a readable TrueType font.
+    static std::unique_ptr<FontMetrics> load(const std::filesystem::path &path);
+    // Loads every path once; later calls return the same metrics (or null) from a process-wide cache.
+    static const FontMetrics *get(const std::filesystem::path &path);
+
+    // Advance width of UTF-8 text at the given font size.
+    double width(const char *str, double size) const;
+    // Hash of the font file, for caches of layouts measured with it.
+    uint64_t fingerprint() const {
+        return m_fingerprint;
+    }
+};
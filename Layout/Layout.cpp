@@ -1,10 +1,20 @@
 #include "Layout.hpp"
+#include "TreeLayout.hpp"
+#include "FontMetrics.hpp"
 #include <graphviz/gvc.h>
 #include <graphviz/gvplugin_render.h>
 #include <graphviz/gvplugin_device.h>
 #include <graphviz/gvplugin_textlayout.h>
 #include <graphviz/gvconfig.h>
 #include <climits>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <cmath>
+#include <tuple>
+#include <set>
+#include <atomic>
 
 constexpr auto invalidIdx = std::numeric_limits<size_t>::max();
 
@@ -12,79 +22,6 @@ Json rgba2Json(const RGBA &col) {
     return { col.r, col.g, col.b, col.a };
 }
 
-class Ellipse final :public Primitive {
-private:
-    glm::vec2 m_pos;
-    glm::vec2 m_size;
-    void record(Json &frame, const PointCast &cast, float scale) const override {
-        auto cpos = cast(m_pos);
-        frame["center"] = { cpos.x, cpos.y };
-        frame["rx"] = m_size.x * scale;
-        frame["ry"] = m_size.y * scale;
-    }
-public:
-    Ellipse(obj_state_t *state, const glm::vec2 &pos, const glm::vec2 &size) :Primitive(state, "Ellipse"), m_pos(pos), m_size(size) {}
-};
-class Bezierline final :public Primitive {
-private:
-    std::vector<glm::vec2> m_vert;
-    void record(Json &frame, const PointCast &cast, float scale) const override {
-        auto &&ps = frame["verts"];
-        for (auto &&p : m_vert) {
-            auto cp = cast(p);
-            ps.push_back(Json{ cp.x, cp.y });
-        }
-    }
-public:
-    Bezierline(obj_state_t *state, const std::vector<glm::vec2> &vert) :Primitive(state, "Bezierline"), m_vert(vert) {}
-};
-class Polyline final :public Primitive {
-private:
-    std::vector<glm::vec2> m_vert;
-    void record(Json &frame, const PointCast &cast, float scale) const override {
-        auto &&ps = frame["verts"];
-        for (auto &&p : m_vert) {
-            auto cp = cast(p);
-            ps.push_back(Json{ cp.x, cp.y });
-        }
-    }
-public:
-    Polyline(obj_state_t *state, const std::vector<glm::vec2> &vert) :Primitive(state, "Polyline"), m_vert(vert) {}
-};
-class Polygon final :public Primitive {
-private:
-    std::vector<glm::vec2> m_vert;
-    void record(Json &frame, const PointCast &cast, float scale) const override {
-        auto &&ps = frame["verts"];
-        for (auto &&p : m_vert) {
-            auto cp = cast(p);
-            ps.push_back(Json{ cp.x, cp.y });
-        }
-    }
-public:
-    Polygon(obj_state_t *state, const std::vector<glm::vec2> &vert) :Primitive(state, "Polygon"), m_vert(vert) {}
-};
-
-class Text final :public Primitive {
-private:
-    std::string m_text;
-    glm::vec2 m_pos;
-    float m_size;
-    Json init() const {
-        auto res = Primitive::init();
-        res["fill"] = true;
-        return res;
-    }
-    void record(Json &frame, const PointCast &cast, float scale) const override {
-        auto cpos = cast(m_pos);
-        frame["center"] = { cpos.x, cpos.y };
-        frame["size"] = m_size * scale;
-        frame["text"] = m_text;
-    }
-public:
-    Text(obj_state_t *state, const std::string &text, const glm::vec2 &pos, float size) :Primitive(state, "Text"), m_text(text), m_pos(pos), m_size(size) {}
-};
-
 static glm::vec2 castVec2(const pointf &p) {
     return { static_cast<float>(p.x), static_cast<float>(p.y) };
 }
@@ -92,7 +29,8 @@ static IDTYPE getID(GVJ_t *job) {
     switch (job->obj->type) {
         case NODE_OBJTYPE:return job->obj->u.n->base.tag.id * 3; break;
         case EDGE_OBJTYPE:return job->obj->u.e->base.tag.id * 3 + 1; break;
-        case ROOTGRAPH_OBJTYPE:return job->obj->u.g->base.tag.id * 3 + 2; break;
+        // There is one root per frame, and a snapshot's root id differs from its source's.
+        case ROOTGRAPH_OBJTYPE:return 2; break;
         default:throw;
             break;
     }
@@ -103,25 +41,60 @@ extern "C" {
     extern __declspec(dllimport) gvplugin_library_t gvplugin_neato_layout_LTX_library;
     extern __declspec(dllimport) gvplugin_library_t gvplugin_dot_layout_LTX_library;
 }
+// The renderer draws every label with this font, whatever its fontname says.
+static std::atomic<const FontMetrics *> labelFont(nullptr);
+static std::once_flag labelFontOnce;
+static const FontMetrics *getLabelFont() {
+    std::call_once(labelFontOnce, [] {
+        if (!labelFont)
+            labelFont = FontMetrics::get("consola.ttf");
+        });
+    return labelFont;
+}
+
 boolean textlayout(textspan_t *span, char **fontpath) {
     span->layout = nullptr;
     span->free_layout = nullptr;
-    span->size.x = span->font->size * strlen(span->str);
+    // Without the font, assume glyphs as wide as the font size.
+    auto font = getLabelFont();
+    span->size.x = (font ? font->width(span->str, span->font->size) : span->font->size * strlen(span->str));
     span->size.y = span->font->size;
     span->yoffset_layout = 0;
     span->yoffset_centerline = 0;
     return TRUE;
 }
-void textspan(GVJ_t *job, pointf p, textspan_t *text) {
+static Primitive &addPrimitive(GVJ_t *job, PrimitiveType type) {
     auto ctx = reinterpret_cast<Frame *>(job->context);
-    ctx->pris[getID(job)][PrimitiveType::text].push_back(std::make_shared<Text>(job->obj, text->str, castVec2(p), static_cast<float>(text->font->size)));
+    auto style = job->obj;
+    assert(style->pencolor.type == color_type_t::RGBA_BYTE);
+    static_assert(sizeof(RGBA) == 4);
+    Primitive pri{};
+    pri.id = getID(job);
+    pri.type = type;
+    memcpy(&pri.col, style->pencolor.u.rgba, sizeof(pri.col));
+    pri.width = static_cast<float>(style->penwidth);
+    pri.vertBegin = static_cast<uint32_t>(ctx->verts.size());
+    pri.textBegin = static_cast<uint32_t>(ctx->text.size());
+    ctx->pris.push_back(pri);
+    return ctx->pris.back();
 }
-void polygon(GVJ_t *job, pointf *A, int n, int filled) {
+static void addVerts(GVJ_t *job, PrimitiveType type, pointf *A, int n) {
     auto ctx = reinterpret_cast<Frame *>(job->context);
-    std::vector<glm::vec2> vert(n);
+    auto &&pri = addPrimitive(job, type);
     for (int i = 0; i < n; ++i)
-        vert[i] = castVec2(A[i]);
-    ctx->pris[getID(job)][PrimitiveType::polygon].push_back(std::make_shared<Polygon>(job->obj, vert));
+        ctx->verts.push_back(castVec2(A[i]));
+    pri.vertCount = static_cast<uint32_t>(n);
+}
+void textspan(GVJ_t *job, pointf p, textspan_t *text) {
+    auto ctx = reinterpret_cast<Frame *>(job->context);
+    auto &&pri = addPrimitive(job, PrimitiveType::text);
+    pri.pos = castVec2(p);
+    pri.size = { static_cast<float>(text->font->size), 0.0f };
+    ctx->text += text->str;
+    pri.textCount = static_cast<uint32_t>(strlen(text->str));
+}
+void polygon(GVJ_t *job, pointf *A, int n, int filled) {
+    addVerts(job, PrimitiveType::polygon, A, n);
 }
 void resolve_color(GVJ_t *job, gvcolor_t *col) {
     switch (col->type) {
@@ -132,25 +105,18 @@ void resolve_color(GVJ_t *job, gvcolor_t *col) {
     col->type = RGBA_BYTE;
 }
 void polyline(GVJ_t *job, pointf *A, int n) {
-    auto ctx = reinterpret_cast<Frame *>(job->context);
-    std::vector<glm::vec2> vert(n);
-    for (int i = 0; i < n; ++i)
-        vert[i] = castVec2(A[i]);
-    ctx->pris[getID(job)][PrimitiveType::polyline].push_back(std::make_shared<Polyline>(job->obj, vert));
+    addVerts(job, PrimitiveType::polyline, A, n);
 }
 void beziercurve(GVJ_t *job, pointf *A, int n, int arrow_beg, int arrow_end, int) {
-    auto ctx = reinterpret_cast<Frame *>(job->context);
-    std::vector<glm::vec2> vert(n);
-    for (int i = 0; i < n; ++i)
-        vert[i] = castVec2(A[i]);
-    ctx->pris[getID(job)][PrimitiveType::curve].push_back(std::make_shared<Bezierline>(job->obj, vert));
+    addVerts(job, PrimitiveType::curve, A, n);
 }
 void ellipse(GVJ_t *job, pointf *A, int filled) {
-    auto ctx = reinterpret_cast<Frame *>(job->context);
+    auto &&pri = addPrimitive(job, PrimitiveType::ellipse);
     auto center = A[0];
     auto hw = A[1].x - A[0].x;
     auto hh = A[1].y - A[0].y;
-    ctx->pris[getID(job)][PrimitiveType::ellipse].push_back(std::make_shared<Ellipse>(job->obj, castVec2(center), castVec2({ hw, hh })));
+    pri.pos = castVec2(center);
+    pri.size = castVec2({ hw, hh });
 }
 void begin_graph(GVJ_t *job) {
     auto ctx = reinterpret_cast<Frame *>(job->context);
@@ -233,12 +199,554 @@ gvplugin_api_t apis[] = {
 
 gvplugin_library_t lib = { "layout", apis };
 
-LayoutContext::LayoutContext() {
-    m_context = gvContext();
-    gvAddLibrary(m_context, &lib);
-    gvAddLibrary(m_context, &gvplugin_core_LTX_library);
-    gvAddLibrary(m_context, &gvplugin_dot_layout_LTX_library);
-    gvAddLibrary(m_context, &gvplugin_neato_layout_LTX_library);
+class Hasher final {
+private:
+    uint64_t m_state;
+public:
+    explicit Hasher(uint64_t basis = 14695981039346656037ull) :m_state(basis) {}
+    void feed(const void *data, size_t size) {
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            m_state ^= bytes[i];
+            m_state *= 1099511628211ull;
+        }
+    }
+    void feed(uint64_t val) {
+        feed(&val, sizeof(val));
+    }
+    void feed(const char *str) {
+        if (!str)str = "";
+        feed(str, strlen(str) + 1);
+    }
+    uint64_t value() const {
+        return m_state;
+    }
+};
+
+static void hashAttrs(Hasher &hasher, Agraph_t *g, int kind, void *obj) {
+    for (auto sym = agnxtattr(g, kind, nullptr); sym; sym = agnxtattr(g, kind, sym)) {
+        hasher.feed(sym->name);
+        hasher.feed(agxget(obj, sym));
+    }
+}
+
+static void feedGraph(Hasher &hasher, Agraph_t *g) {
+    hasher.feed(static_cast<uint64_t>(agisdirected(g)));
+    hashAttrs(hasher, g, AGRAPH, g);
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n)) {
+        hasher.feed(AGID(n));
+        hashAttrs(hasher, g, AGNODE, n);
+    }
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n))
+        for (auto e = agfstout(g, n); e; e = agnxtout(g, e)) {
+            hasher.feed(AGID(e));
+            hasher.feed(AGID(agtail(e)));
+            hasher.feed(AGID(aghead(e)));
+            hashAttrs(hasher, g, AGEDGE, e);
+        }
+}
+
+static uint64_t hashGraph(Agraph_t *g) {
+    Hasher hasher;
+    feedGraph(hasher, g);
+    return hasher.value();
+}
+
+/*
+Layouts stored across runs, one file per graph named by a 128-bit key (two FNV-1a passes with
+different offset bases over the engine and the graph, including seeded positions). Files hold
+the Frame arrays as raw bytes; loading a file refreshes its time stamp so that trimming drops
+the least recently used layouts first.
+*/
+class DiskCache final {
+private:
+    static constexpr uint32_t magic = 0x434c5a56;
+    static constexpr uint32_t version = 1;
+    std::filesystem::path m_dir;
+    uintmax_t m_maxBytes;
+    uintmax_t m_bytes;
+    std::mutex m_mutex;
+
+    template<typename T>
+    static void writeArray(std::ostream &out, const std::vector<T> &vec) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        uint64_t size = vec.size();
+        out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        out.write(reinterpret_cast<const char *>(vec.data()), sizeof(T) * vec.size());
+    }
+    // left counts the bytes not read yet, so that a corrupt size cannot ask for more than the file holds.
+    template<typename T>
+    static bool readArray(std::istream &in, std::vector<T> &vec, uintmax_t &left) {
+        uint64_t size = 0;
+        if (left < sizeof(size) || !in.read(reinterpret_cast<char *>(&size), sizeof(size)))
+            return false;
+        left -= sizeof(size);
+        if (size > left / sizeof(T))
+            return false;
+        left -= size * sizeof(T);
+        vec.resize(static_cast<size_t>(size));
+        return static_cast<bool>(in.read(reinterpret_cast<char *>(vec.data()), sizeof(T) * vec.size()));
+    }
+    // Every primitive has a known type and its vertices and text lie within the pools.
+    static bool consistent(const Frame &frame) {
+        for (auto &&pri : frame.pris) {
+            if (pri.type < PrimitiveType::text || pri.type > PrimitiveType::ellipse)
+                return false;
+            if (pri.vertBegin > frame.verts.size() || pri.vertCount > frame.verts.size() - pri.vertBegin)
+                return false;
+            if (pri.textBegin > frame.text.size() || pri.textCount > frame.text.size() - pri.textBegin)
+                return false;
+        }
+        return true;
+    }
+    std::filesystem::path file(const std::string &key) const {
+        return m_dir / (key + ".layout");
+    }
+    void trim() {
+        if (m_bytes <= m_maxBytes)
+            return;
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> files;
+        std::error_code ec;
+        for (auto &&entry : std::filesystem::directory_iterator(m_dir, ec))
+            if (entry.path().extension() == ".layout")
+                files.emplace_back(entry.last_write_time(ec), entry.path());
+        std::sort(files.begin(), files.end());
+        for (auto &&item : files) {
+            if (m_bytes <= m_maxBytes)
+                break;
+            auto size = std::filesystem::file_size(item.second, ec);
+            if (!ec && std::filesystem::remove(item.second, ec))
+                m_bytes -= std::min(m_bytes, size);
+        }
+    }
+public:
+    DiskCache(const std::filesystem::path &dir, uintmax_t maxBytes) :m_dir(dir), m_maxBytes(maxBytes), m_bytes(0) {
+        std::filesystem::create_directories(m_dir);
+        for (auto &&entry : std::filesystem::directory_iterator(m_dir))
+            if (entry.path().extension() == ".layout")
+                m_bytes += entry.file_size();
+        trim();
+    }
+    static std::string key(Agraph_t *g, const char *engine) {
+        Hasher lo, hi(0x6c62272e07bb0142ull);
+        for (auto hasher : { &lo, &hi }) {
+            hasher->feed(static_cast<uint64_t>(version));
+            hasher->feed(engine);
+            // Label sizes, and thereby the layout, depend on the font.
+            auto font = getLabelFont();
+            hasher->feed(font ? font->fingerprint() : 0);
+            feedGraph(*hasher, g);
+        }
+        char buf[33];
+        snprintf(buf, sizeof(buf), "%016llx%016llx", static_cast<unsigned long long>(hi.value()), static_cast<unsigned long long>(lo.value()));
+        return buf;
+    }
+    // A missing, truncated or corrupt file is a miss and leaves frame untouched.
+    bool load(const std::string &key, Frame &frame) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto path = file(key);
+        std::error_code ec;
+        auto left = std::filesystem::file_size(path, ec);
+        if (ec)
+            return false;
+        std::ifstream in(path, std::ios::binary);
+        uint32_t header[2] = { 0, 0 };
+        Frame res;
+        if (left < sizeof(header) + sizeof(res.size))
+            return false;
+        left -= sizeof(header) + sizeof(res.size);
+        if (!in.read(reinterpret_cast<char *>(header), sizeof(header)) || header[0] != magic || header[1] != version)
+            return false;
+        std::vector<char> text;
+        if (!in.read(reinterpret_cast<char *>(&res.size), sizeof(res.size))
+            || !readArray(in, res.pris, left) || !readArray(in, res.verts, left) || !readArray(in, text, left) || !readArray(in, res.nodes, left))
+            return false;
+        res.text.assign(text.cbegin(), text.cend());
+        if (!consistent(res))
+            return false;
+        frame = std::move(res);
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+        return true;
+    }
+    void store(const std::string &key, const Frame &frame) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto path = file(key);
+        auto tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            uint32_t header[2] = { magic, version };
+            out.write(reinterpret_cast<const char *>(header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(&frame.size), sizeof(frame.size));
+            writeArray(out, frame.pris);
+            writeArray(out, frame.verts);
+            writeArray(out, std::vector<char>(frame.text.cbegin(), frame.text.cend()));
+            writeArray(out, frame.nodes);
+            if (!out)
+                return;
+        }
+        std::error_code ec;
+        if (std::filesystem::exists(path, ec))
+            m_bytes -= std::min(m_bytes, std::filesystem::file_size(path, ec));
+        std::filesystem::rename(tmp, path, ec);
+        if (ec)
+            return;
+        m_bytes += std::filesystem::file_size(path, ec);
+        trim();
+    }
+};
+
+// cgraph, the layout engines and their contexts keep state in process-wide globals, so every call into GraphViz holds this lock.
+static std::mutex graphvizMutex;
+
+static GVC_t *createContext() {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    auto gvc = gvContext();
+    gvAddLibrary(gvc, &lib);
+    gvAddLibrary(gvc, &gvplugin_core_LTX_library);
+    gvAddLibrary(gvc, &gvplugin_dot_layout_LTX_library);
+    gvAddLibrary(gvc, &gvplugin_neato_layout_LTX_library);
+    return gvc;
+}
+
+static void freeContext(GVC_t *gvc) {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    gvFinalize(gvc);
+    gvFreeContext(gvc);
+}
+
+static bool primitiveLess(const Primitive &lhs, const Primitive &rhs) {
+    return lhs.id != rhs.id ? lhs.id < rhs.id : lhs.type < rhs.type;
+}
+
+void LayoutContext::countHit(bool hit) {
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    ++(hit ? m_stats.hits : m_stats.misses);
+}
+
+// Writes the previous positions into pos (in points, hence inputscale) for the engine to start from.
+static void seedPositions(Agraph_t *g, const Frame &seed, const WarmStart &warm) {
+    agattr(g, AGRAPH, const_cast<char *>("inputscale"), "72");
+    auto maxIter = agget(g, const_cast<char *>("maxiter"));
+    if ((!maxIter || !*maxIter) && warm.maxIter > 0)
+        agattr(g, AGRAPH, const_cast<char *>("maxiter"), std::to_string(warm.maxIter).c_str());
+
+    auto pos = agattr(g, AGNODE, const_cast<char *>("pos"), "");
+    char buf[64];
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n)) {
+        auto iter = std::lower_bound(seed.nodes.cbegin(), seed.nodes.cend(), static_cast<uint64_t>(AGID(n)), [] (const NodePos &item, uint64_t id) {return item.id < id; });
+        if (iter == seed.nodes.cend() || iter->id != AGID(n))
+            continue;
+        snprintf(buf, sizeof(buf), "%f,%f%s", iter->pos.x, iter->pos.y, warm.pinExisting ? "!" : "");
+        agxset(n, pos, buf);
+    }
+}
+
+static const char *engineOf(Agraph_t *g) {
+    auto engine = agget(g, const_cast<char *>("layout"));
+    return engine && *engine ? engine : "dot";
+}
+
+// Places a tree-shaped graph (edges point from parent to child) with the tidy tree layout and pins every node
+// for the nop engine. Returns false if g is not a forest.
+static bool placeTree(Agraph_t *g) {
+    std::vector<Agnode_t *> nodes;
+    std::map<IDTYPE, size_t> index;
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n)) {
+        index[AGID(n)] = nodes.size();
+        nodes.push_back(n);
+    }
+
+    std::vector<size_t> parent(nodes.size(), noParent);
+    std::vector<float> widths(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        auto width = agget(nodes[i], const_cast<char *>("width"));
+        widths[i] = static_cast<float>(width && *width ? atof(width) : 0.75) * 72.0f;
+        for (auto e = agfstout(g, nodes[i]); e; e = agnxtout(g, e)) {
+            auto &&p = parent[index[AGID(aghead(e))]];
+            if (p != noParent)
+                return false;
+            p = i;
+        }
+    }
+    auto pos = layoutTree(parent, widths);
+    if (pos.empty())
+        return false;
+
+    auto sym = agattr(g, AGNODE, const_cast<char *>("pos"), "");
+    char buf[64];
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        // GraphViz coordinates grow upwards.
+        snprintf(buf, sizeof(buf), "%f,%f!", pos[i].x, -pos[i].y);
+        agxset(nodes[i], sym, buf);
+    }
+    auto splines = agget(g, const_cast<char *>("splines"));
+    if (!splines || !*splines)
+        agattr(g, AGRAPH, const_cast<char *>("splines"), "line");
+    return true;
+}
+
+// The default id discipline refuses caller-chosen ids; snapshots need them to keep primitives matched across frames.
+static long allocID(void *, int, IDTYPE) {
+    return TRUE;
+}
+
+static Agdisc_t *snapshotDisc() {
+    static Agiddisc_t id = [] {
+        auto disc = AgIdDisc;
+        disc.alloc = allocID;
+        return disc;
+    }();
+    static Agdisc_t disc = { &AgMemDisc, &id, &AgIoDisc };
+    return &disc;
+}
+
+// Copies the nodes accepted by keep, and the edges between them, into a new graph with the same ids and attributes.
+static Agraph_t *copyGraph(Agraph_t *source, const std::function<bool(Agnode_t *)> &keep) {
+    Agdesc_t desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.directed = agisdirected(source);
+    auto res = agopen(agnameof(source), desc, snapshotDisc());
+
+    for (int kind : { AGRAPH, AGNODE, AGEDGE })
+        for (auto sym = agnxtattr(source, kind, nullptr); sym; sym = agnxtattr(source, kind, sym))
+            agattr(res, kind, sym->name, sym->defval);
+    agcopyattr(source, res);
+
+    std::vector<Agedge_t *> edges;
+    for (auto n = agfstnode(source); n; n = agnxtnode(source, n)) {
+        if (!keep(n))
+            continue;
+        agcopyattr(n, agidnode(res, AGID(n), 1));
+        for (auto e = agfstout(source, n); e; e = agnxtout(source, e))
+            if (keep(aghead(e)))
+                edges.push_back(e);
+    }
+    // Recreate edges in creation order so that iteration (and hence layout) matches the source.
+    std::sort(edges.begin(), edges.end(), [] (Agedge_t *lhs, Agedge_t *rhs) {return AGSEQ(lhs) < AGSEQ(rhs); });
+    for (auto e : edges) {
+        auto tail = agidnode(res, AGID(agtail(e)), 0);
+        auto head = agidnode(res, AGID(aghead(e)), 0);
+        agcopyattr(e, agidedge(res, tail, head, AGID(e), 1));
+    }
+    return res;
+}
+
+static const char *clusterOf(Agnode_t *n) {
+    auto name = agget(n, const_cast<char *>("cluster"));
+    return name ? name : "";
+}
+
+static bool hasClusters(Agraph_t *g) {
+    if (!agattr(g, AGNODE, const_cast<char *>("cluster"), nullptr))
+        return false;
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n))
+        if (*clusterOf(n))
+            return true;
+    return false;
+}
+
+/*
+Lays out every cluster (the nodes sharing a cluster attribute) on its own, then only a graph of
+cluster boxes and unclustered nodes, and pins each node at its box plus its offset in the box for
+the nop engine. Cluster layouts are cached by content, so an edit lays out nothing but its own
+cluster and the boxes again. Returns false if g has no clusters.
+*/
+bool LayoutContext::placeClusters(GVC_t *gvc, Agraph_t *g, const char *engine) {
+    std::map<std::string, std::vector<Agnode_t *>> members;
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n))
+        if (*clusterOf(n))
+            members[clusterOf(n)].push_back(n);
+    if (members.empty())
+        return false;
+
+    std::map<std::string, ClusterLayout> clusters;
+    for (auto &&item : members) {
+        auto &&name = item.first;
+        auto sub = copyGraph(g, [&name] (Agnode_t *n) {return name == clusterOf(n); });
+        Hasher hasher;
+        hasher.feed(engine);
+        feedGraph(hasher, sub);
+        auto key = hasher.value();
+
+        auto &&cluster = clusters[name];
+        bool hit;
+        {
+            std::lock_guard<std::mutex> lock(m_clusterMutex);
+            auto iter = m_clusters.find(key);
+            hit = (iter != m_clusters.cend());
+            if (hit)
+                cluster = iter->second;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            ++(hit ? m_stats.clusterHits : m_stats.clusterMisses);
+        }
+        if (!hit) {
+            gvLayout(gvc, sub, engine);
+            auto bb = GD_bb(sub);
+            auto center = (castVec2(bb.LL) + castVec2(bb.UR)) * 0.5f;
+            for (auto n = agfstnode(sub); n; n = agnxtnode(sub, n))
+                cluster.nodes.push_back({ AGID(n), castVec2(ND_coord(n)) - center });
+            std::sort(cluster.nodes.begin(), cluster.nodes.end(), [] (const NodePos &lhs, const NodePos &rhs) {return lhs.id < rhs.id; });
+            cluster.size = castVec2(bb.UR) - castVec2(bb.LL);
+            gvFreeLayout(gvc, sub);
+
+            std::lock_guard<std::mutex> lock(m_clusterMutex);
+            // Layouts of old graph states are not worth keeping around forever.
+            if (m_clusters.size() >= 4096)
+                m_clusters.clear();
+            m_clusters[key] = cluster;
+        }
+        agclose(sub);
+    }
+
+    // Clusters become fixed-size boxes; unclustered nodes and edges between different boxes are copied.
+    Agdesc_t desc;
+    memset(&desc, 0, sizeof(desc));
+    desc.directed = agisdirected(g);
+    auto top = agopen(const_cast<char *>("clusters"), desc, nullptr);
+    for (int kind : { AGRAPH, AGNODE, AGEDGE })
+        for (auto sym = agnxtattr(g, kind, nullptr); sym; sym = agnxtattr(g, kind, sym))
+            agattr(top, kind, sym->name, sym->defval);
+    agcopyattr(g, top);
+
+    std::map<std::string, Agnode_t *> boxes;
+    std::map<Agnode_t *, Agnode_t *> rep;
+    char buf[64];
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n)) {
+        auto name = clusterOf(n);
+        if (!*name) {
+            rep[n] = agnode(top, nullptr, 1);
+            agcopyattr(n, rep[n]);
+            continue;
+        }
+        auto &&box = boxes[name];
+        if (!box) {
+            box = agnode(top, nullptr, 1);
+            auto &&size = clusters[name].size;
+            auto set = [box] (const char *key, const char *val) {
+                agsafeset(box, const_cast<char *>(key), const_cast<char *>(val), const_cast<char *>(""));
+            };
+            set("shape", "box");
+            set("fixedsize", "true");
+            set("label", "");
+            snprintf(buf, sizeof(buf), "%f", size.x / 72.0f);
+            set("width", buf);
+            snprintf(buf, sizeof(buf), "%f", size.y / 72.0f);
+            set("height", buf);
+        }
+        rep[n] = box;
+    }
+    std::set<std::pair<Agnode_t *, Agnode_t *>> linked;
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n))
+        for (auto e = agfstout(g, n); e; e = agnxtout(g, e)) {
+            auto tail = rep[n], head = rep[aghead(e)];
+            if (tail != head && linked.emplace(tail, head).second)
+                agcopyattr(e, agedge(top, tail, head, nullptr, 1));
+        }
+
+    gvLayout(gvc, top, engine);
+    auto sym = agattr(g, AGNODE, const_cast<char *>("pos"), "");
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n)) {
+        auto pos = castVec2(ND_coord(rep[n]));
+        if (*clusterOf(n)) {
+            auto &&nodes = clusters[clusterOf(n)].nodes;
+            auto iter = std::lower_bound(nodes.cbegin(), nodes.cend(), static_cast<uint64_t>(AGID(n)), [] (const NodePos &item, uint64_t id) {return item.id < id; });
+            pos += iter->pos;
+        }
+        snprintf(buf, sizeof(buf), "%f,%f!", pos.x, pos.y);
+        agxset(n, sym, buf);
+    }
+    gvFreeLayout(gvc, top);
+    agclose(top);
+
+    auto splines = agget(g, const_cast<char *>("splines"));
+    if (!splines || !*splines)
+        agattr(g, AGRAPH, const_cast<char *>("splines"), "line");
+    return true;
+}
+
+Frame LayoutContext::layout(GVC_t *gvc, Agraph_t *g, const Frame *seed, const WarmStart &warm) {
+    std::unique_lock<std::mutex> lock(graphvizMutex);
+    auto engine = engineOf(g);
+    bool tree = !strcmp(engine, "tree");
+    bool clustered = !tree && hasClusters(g);
+    // Cached cluster layouts take the place of a warm start.
+    if (seed && !tree && !clustered)
+        seedPositions(g, *seed, warm);
+
+    std::string key;
+    if (m_disk) {
+        key = DiskCache::key(g, engine);
+        Frame frame;
+        lock.unlock();
+        if (m_disk->load(key, frame)) {
+            std::lock_guard<std::mutex> stats(m_statsMutex);
+            ++m_stats.diskHits;
+            return frame;
+        }
+        lock.lock();
+    }
+
+    auto beg = std::chrono::steady_clock::now();
+    auto run = engine;
+    if (tree) {
+        // GraphViz only draws the placed tree; a graph that is not a forest falls back to dot.
+        run = (placeTree(g) ? "nop" : "dot");
+        agset(g, const_cast<char *>("layout"), const_cast<char *>(run));
+    }
+    else if (clustered && placeClusters(gvc, g, engine)) {
+        run = "nop";
+        agset(g, const_cast<char *>("layout"), const_cast<char *>(run));
+    }
+    gvLayout(gvc, g, run);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - beg;
+    {
+        std::lock_guard<std::mutex> stats(m_statsMutex);
+        auto &&stat = m_stats.engines[engine];
+        ++stat.layouts;
+        stat.seconds += elapsed.count();
+    }
+
+    Frame frame;
+    gvRenderContext(gvc, g, "layout", &frame);
+    for (auto n = agfstnode(g); n; n = agnxtnode(g, n))
+        frame.nodes.push_back({ AGID(n), castVec2(ND_coord(n)) });
+    std::sort(frame.nodes.begin(), frame.nodes.end(), [] (const NodePos &lhs, const NodePos &rhs) {return lhs.id < rhs.id; });
+    gvFreeLayout(gvc, g);
+    lock.unlock();
+    std::stable_sort(frame.pris.begin(), frame.pris.end(), primitiveLess);
+    if (m_disk)
+        m_disk->store(key, frame);
+    return frame;
+}
+
+Snapshot::Snapshot(Agraph_t *source) :m_source(source) {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    m_graph = copyGraph(source, [] (Agnode_t *) {return true; });
+}
+
+Snapshot::Snapshot(Snapshot &&rhs) noexcept :m_source(rhs.m_source), m_graph(rhs.m_graph) {
+    rhs.m_graph = nullptr;
+}
+
+Agraph_t *Snapshot::source() const {
+    return m_source;
+}
+
+Agraph_t *Snapshot::graph() const {
+    return m_graph;
+}
+
+Snapshot::~Snapshot() {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    if (m_graph)
+        agclose(m_graph);
+}
+
+LayoutContext::LayoutContext(size_t workers) :m_stats{ 0, 0, 0, 0, 0, {} }, m_workers(std::max<size_t>(1, workers)), m_stop(false) {
+    m_context = createContext();
 
     /*
     int sz;
@@ -248,128 +756,784 @@ LayoutContext::LayoutContext() {
         */
 }
 
-Frame LayoutContext::render(Agraph_t *g) {
-    gvLayout(m_context, g, "dot");
+void LayoutContext::setFont(const std::filesystem::path &path) {
+    labelFont = FontMetrics::get(path);
+}
+
+void LayoutContext::work() {
+    auto gvc = createContext();
+    while (true) {
+        std::function<void(GVC_t *)> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_ready.wait(lock, [this] {return m_stop || !m_jobs.empty(); });
+            if (m_jobs.empty())
+                break;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        job(gvc);
+    }
+    freeContext(gvc);
+}
+
+Frame LayoutContext::render(Agraph_t *g, const WarmStart &warm) {
+    uint64_t hash;
+    {
+        std::lock_guard<std::mutex> lock(graphvizMutex);
+        hash = hashGraph(g);
+    }
+    auto iter = m_memo.find(g);
+    if (iter != m_memo.cend() && iter->second.hash == hash) {
+        countHit(true);
+        return iter->second.frame.get();
+    }
+    countHit(false);
+
     Frame frame;
-    gvRenderContext(m_context, g, "layout", &frame);
-    gvFreeLayout(m_context, g);
+    auto seed = (warm.enabled && iter != m_memo.cend() ? &iter->second.frame.get() : nullptr);
+    if (seed || !strcmp(engineOf(g), "tree") || hasClusters(g)) {
+        // Seeding, tree and cluster placement write attributes, so they work on a copy that the memo never hashes.
+        Snapshot copy(g);
+        frame = layout(m_context, copy.graph(), seed, warm);
+    }
+    else frame = layout(m_context, g, nullptr, warm);
+    std::promise<Frame> done;
+    done.set_value(frame);
+    m_memo[g] = { hash, done.get_future().share() };
     return frame;
 }
 
-void LayoutContext::renderFrames(Json &drawables, const std::vector<std::pair<float, Frame>> &frames, float width, float height) const {
-    float r1 = width / height;
+void LayoutContext::enqueue(float ts, Snapshot snapshot, const WarmStart &warm) {
+    auto g = snapshot.source();
+    uint64_t hash;
+    {
+        std::lock_guard<std::mutex> lock(graphvizMutex);
+        hash = hashGraph(snapshot.graph());
+    }
+    auto iter = m_memo.find(g);
+    if (iter != m_memo.cend() && iter->second.hash == hash) {
+        countHit(true);
+        m_queued.emplace_back(ts, iter->second.frame);
+        return;
+    }
+    countHit(false);
 
-    const Frame *lastFrame = nullptr;
-    std::vector<std::shared_ptr<Primitive>> empty;
-    for (auto &&fr : frames) {
-        auto ts = fr.first;
-        const Frame &frame = fr.second;
+    // A warm start waits for the previous layout of the same graph. Jobs are taken in order, so that one is already running.
+    std::shared_future<Frame> prev;
+    if (warm.enabled && iter != m_memo.cend())
+        prev = iter->second.frame;
+    auto task = std::make_shared<std::packaged_task<Frame(GVC_t *)>>([this, snap = std::move(snapshot), prev, warm] (GVC_t *gvc) {
+        return layout(gvc, snap.graph(), prev.valid() ? &prev.get() : nullptr, warm);
+        });
+    auto frame = task->get_future().share();
+    m_memo[g] = { hash, frame };
+    m_queued.emplace_back(ts, frame);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.emplace_back([task] (GVC_t *gvc) {(*task)(gvc); });
+    }
+    m_ready.notify_one();
 
-        float dw = frame.size.x, dh = frame.size.y;
-        float r2 = frame.size.x / frame.size.y;
+    while (m_pool.size() < m_workers)
+        m_pool.emplace_back(&LayoutContext::work, this);
+}
 
-        float scale = (r2 > r1 ? (width / dw) : height / dh);
-        dw *= scale; dh *= scale;
-        glm::vec2 offset = { (width - dw) * 0.5f, (height - dh) * 0.5f };
+std::vector<std::pair<float, Frame>> LayoutContext::collect() {
+    std::stable_sort(m_queued.begin(), m_queued.end(), [] (const auto &lhs, const auto &rhs) {return lhs.first < rhs.first; });
+    std::vector<std::pair<float, Frame>> res;
+    for (auto &&item : m_queued)
+        res.emplace_back(item.first, item.second.get());
+    m_queued.clear();
+    return res;
+}
 
-        PointCast cast = [offset, scale] (const glm::vec2 &p) {return p * scale + offset; };
+void LayoutContext::setDiskCache(const std::filesystem::path &dir, uintmax_t maxBytes) {
+    m_disk = std::make_unique<DiskCache>(dir, maxBytes);
+}
+
+void LayoutContext::forget(Agraph_t *g) {
+    m_memo.erase(g);
+}
+
+LayoutStats LayoutContext::stats() const {
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    return m_stats;
+}
+
+static const char *typeName(PrimitiveType type) {
+    switch (type) {
+        case PrimitiveType::text:return "Text"; break;
+        case PrimitiveType::curve:return "Bezierline"; break;
+        case PrimitiveType::polygon:return "Polygon"; break;
+        case PrimitiveType::polyline:return "Polyline"; break;
+        case PrimitiveType::ellipse:return "Ellipse"; break;
+        default:throw;
+            break;
+    }
+}
+
+static void fillKeyFrame(KeyFrame &frame, float ts, const Frame &owner, const Primitive &pri, const PointCast &cast, float scale) {
+    frame.ts = ts;
+    frame.type = pri.type;
+    frame.hidden = false;
+    frame.verts.clear();
+    frame.text.clear();
+    switch (pri.type) {
+        case PrimitiveType::text:
+            frame.center = cast(pri.pos);
+            frame.size = pri.size.x * scale;
+            frame.text.assign(owner.text, pri.textBegin, pri.textCount);
+            break;
+        case PrimitiveType::ellipse:
+            frame.center = cast(pri.pos);
+            frame.radius = pri.size * scale;
+            break;
+        default:
+            for (uint32_t i = 0; i < pri.vertCount; ++i)
+                frame.verts.push_back(cast(owner.verts[pri.vertBegin + i]));
+            break;
+    }
+}
+
+bool KeyFrame::sameValues(const KeyFrame &rhs) const {
+    if (type != rhs.type)
+        return false;
+    switch (type) {
+        case PrimitiveType::text:
+            return center == rhs.center && size == rhs.size && text == rhs.text;
+            break;
+        case PrimitiveType::ellipse:
+            return center == rhs.center && radius == rhs.radius;
+            break;
+        default:
+            return verts == rhs.verts;
+            break;
+    }
+}
+
+SceneSink::~SceneSink() {}
+
+JsonDomSink::JsonDomSink(Json &drawables) :m_drawables(drawables) {}
+
+size_t JsonDomSink::addDrawable(PrimitiveType type, const RGBA &col, float width) {
+    Json base;
+    base["color"] = rgba2Json(col);
+    base["width"] = width;
+    base["type"] = typeName(type);
+    if (type == PrimitiveType::text)
+        base["fill"] = true;
+    m_drawables.push_back(std::move(base));
+    return m_drawables.size() - 1;
+}
+
+void JsonDomSink::addKeyFrame(size_t drawable, const KeyFrame &frame) {
+    Json res;
+    res["ts"] = frame.ts;
+    if (frame.hidden) {
+        res["mix_mode"] = "steep";
+        res["color"] = { 0, 0, 0, 0 };
+    }
+    switch (frame.type) {
+        case PrimitiveType::text:
+            res["center"] = { frame.center.x, frame.center.y };
+            res["size"] = frame.size;
+            res["text"] = frame.text;
+            break;
+        case PrimitiveType::ellipse:
+            res["center"] = { frame.center.x, frame.center.y };
+            res["rx"] = frame.radius.x;
+            res["ry"] = frame.radius.y;
+            break;
+        default:
+        {
+            auto &&ps = res["verts"];
+            for (auto &&p : frame.verts)
+                ps.push_back(Json{ p.x, p.y });
+        }
+        break;
+    }
+    m_drawables[drawable]["frame"].push_back(std::move(res));
+}
+
+JsonStreamSink::JsonStreamSink(std::ostream &out, const Json &header) :m_out(out), m_header(header.dump()) {}
+
+void JsonStreamSink::writeNumber(std::string &buf, float val) {
+    if (!std::isfinite(val)) {
+        buf += "null";
+        return;
+    }
+    // Nine significant digits round-trip every float.
+    char tmp[32];
+    buf.append(tmp, snprintf(tmp, sizeof(tmp), "%.9g", val));
+}
+
+void JsonStreamSink::writePoint(std::string &buf, const glm::vec2 &p) {
+    buf += '[';
+    writeNumber(buf, p.x);
+    buf += ',';
+    writeNumber(buf, p.y);
+    buf += ']';
+}
+
+size_t JsonStreamSink::addDrawable(PrimitiveType type, const RGBA &col, float width) {
+    std::string buf = "{\"color\":[";
+    for (auto c : { col.r, col.g, col.b, col.a }) {
+        buf += std::to_string(c);
+        buf += ',';
+    }
+    buf.back() = ']';
+    if (type == PrimitiveType::text)
+        buf += ",\"fill\":true";
+    buf += ",\"type\":\"";
+    buf += typeName(type);
+    buf += "\",\"width\":";
+    writeNumber(buf, width);
+    buf += ",\"frame\":[";
+    m_drawables.push_back(std::move(buf));
+    m_empty.push_back(true);
+    return m_drawables.size() - 1;
+}
+
+void JsonStreamSink::addKeyFrame(size_t drawable, const KeyFrame &frame) {
+    auto &&buf = m_drawables[drawable];
+    if (!m_empty[drawable])
+        buf += ',';
+    m_empty[drawable] = false;
+    buf += "{\"ts\":";
+    writeNumber(buf, frame.ts);
+    if (frame.hidden)
+        buf += ",\"mix_mode\":\"steep\",\"color\":[0,0,0,0]";
+    switch (frame.type) {
+        case PrimitiveType::text:
+            buf += ",\"center\":";
+            writePoint(buf, frame.center);
+            buf += ",\"size\":";
+            writeNumber(buf, frame.size);
+            buf += ",\"text\":";
+            buf += Json(frame.text).dump();
+            break;
+        case PrimitiveType::ellipse:
+            buf += ",\"center\":";
+            writePoint(buf, frame.center);
+            buf += ",\"rx\":";
+            writeNumber(buf, frame.radius.x);
+            buf += ",\"ry\":";
+            writeNumber(buf, frame.radius.y);
+            break;
+        default:
+            buf += ",\"verts\":[";
+            for (size_t i = 0; i < frame.verts.size(); ++i) {
+                if (i)
+                    buf += ',';
+                writePoint(buf, frame.verts[i]);
+            }
+            buf += ']';
+            break;
+    }
+    buf += '}';
+}
+
+void JsonStreamSink::finish() {
+    // The header is a JSON object; the drawables go in before its closing brace.
+    auto header = m_header;
+    header.pop_back();
+    m_out << header << (header.size() > 1 ? "," : "") << "\"drawables\":[";
+    for (size_t i = 0; i < m_drawables.size(); ++i) {
+        if (i)
+            m_out << ',';
+        m_out << m_drawables[i] << "]}";
+        std::string().swap(m_drawables[i]);
+    }
+    m_out << "]}";
+}
+
+// LevelOfDetail in scene units.
+struct Detail final {
+    bool enabled;
+    float point, tolerance, text;
+};
 
-        for (auto &&buk1 : frame.pris) {
-            auto id = buk1.first;
-            auto &&pris = buk1.second;
+static float segmentDistance(const glm::vec2 &p, const glm::vec2 &a, const glm::vec2 &b) {
+    auto ab = b - a;
+    auto len = glm::dot(ab, ab);
+    float u = (len > 0.0f ? std::clamp(glm::dot(p - a, ab) / len, 0.0f, 1.0f) : 0.0f);
+    return glm::length(p - (a + ab * u));
+}
+
+/*
+Simplifies a chain of cubic Bezier segments (3k + 1 control points). A segment whose control
+points lie within tolerance / 2 of its chord is flat, and the curve stays in the hull of its
+control points; runs of flat segments are reduced to a polyline through their end points
+(Douglas-Peucker, again within tolerance / 2), and each kept span becomes a straight segment.
+*/
+static void simplifyCurve(std::vector<glm::vec2> &verts, float tolerance) {
+    if (verts.size() < 7 || verts.size() % 3 != 1)
+        return;
+    float half = tolerance * 0.5f;
+    size_t segs = verts.size() / 3;
+    auto flat = [&] (size_t s) {
+        auto &&a = verts[s * 3], &&b = verts[s * 3 + 3];
+        return segmentDistance(verts[s * 3 + 1], a, b) <= half && segmentDistance(verts[s * 3 + 2], a, b) <= half;
+    };
+
+    std::vector<glm::vec2> res = { verts.front() };
+    std::vector<bool> keep;
+    std::vector<std::pair<size_t, size_t>> stack;
+    for (size_t s = 0; s < segs;) {
+        if (!flat(s)) {
+            res.insert(res.end(), verts.begin() + s * 3 + 1, verts.begin() + s * 3 + 4);
+            ++s;
+            continue;
+        }
+        size_t e = s + 1;
+        while (e < segs && flat(e))
+            ++e;
+        // End points s..e of the run, indexed by segment.
+        keep.assign(e - s + 1, false);
+        keep.front() = keep.back() = true;
+        stack.assign(1, { s, e });
+        while (!stack.empty()) {
+            auto lo = stack.back().first, hi = stack.back().second;
+            stack.pop_back();
+            float worst = 0.0f;
+            size_t mid = lo;
+            for (size_t m = lo + 1; m < hi; ++m) {
+                auto d = segmentDistance(verts[m * 3], verts[lo * 3], verts[hi * 3]);
+                if (d > worst)
+                    worst = d, mid = m;
+            }
+            if (worst > half) {
+                keep[mid - s] = true;
+                stack.emplace_back(lo, mid);
+                stack.emplace_back(mid, hi);
+            }
+        }
+        for (size_t m = s + 1; m <= e; ++m)
+            if (keep[m - s]) {
+                auto a = res.back(), b = verts[m * 3];
+                res.push_back(glm::mix(a, b, 1.0f / 3.0f));
+                res.push_back(glm::mix(a, b, 2.0f / 3.0f));
+                res.push_back(b);
+            }
+        s = e;
+    }
+    verts.swap(res);
+}
 
-            std::remove_reference_t< decltype(pris)> *cmp1 = nullptr;
-            if (lastFrame) {
-                auto iter = lastFrame->pris.find(id);
-                if (iter != lastFrame->pris.cend())
-                    cmp1 = &iter->second;
+// Draws nodes smaller than a point as one and simplifies curves; labels are dropped before they get here.
+static void reduceDetail(KeyFrame &frame, const Detail &detail) {
+    switch (frame.type) {
+        case PrimitiveType::ellipse:
+            if (std::max(frame.radius.x, frame.radius.y) * 2.0f < detail.point)
+                frame.radius = glm::vec2(detail.point * 0.5f);
+            break;
+        case PrimitiveType::polygon:
+        {
+            if (frame.verts.empty())
+                break;
+            glm::vec2 lo = frame.verts.front(), hi = lo;
+            for (auto &&v : frame.verts) {
+                lo = glm::min(lo, v);
+                hi = glm::max(hi, v);
+            }
+            if (std::max(hi.x - lo.x, hi.y - lo.y) < detail.point) {
+                auto c = (lo + hi) * 0.5f;
+                float r = detail.point * 0.5f;
+                frame.verts = { c + glm::vec2(-r, -r), c + glm::vec2(r, -r), c + glm::vec2(r, r), c + glm::vec2(-r, r) };
             }
+        }
+        break;
+        case PrimitiveType::curve:
+            simplifyCurve(frame.verts, detail.tolerance);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+Passes keyframes of a graph animation on to a sink. With changesOnly, a keyframe equal to the
+previous one of its drawable is held back; it is written (at the last time it was seen) only
+once the value changes or the primitive disappears, which renders the same as writing them all.
+With recycle, the drawable of a vanished primitive gets a hidden end keyframe and is handed to
+the next new primitive with the same type, colour and width.
+*/
+class KeyFrameWriter final {
+private:
+    using SlotKey = std::tuple<PrimitiveType, uint32_t, float>;
+    struct Track final {
+        KeyFrame frame;
+        bool held;
+        SlotKey key;
+    };
+    SceneSink &m_sink;
+    bool m_changesOnly;
+    bool m_recycle;
+    Detail m_detail;
+    std::vector<Track> m_tracks;
+    std::map<SlotKey, std::vector<size_t>> m_free;
+    KeyFrame m_scratch;
+
+    static SlotKey slotKey(const Primitive &pri) {
+        uint32_t col;
+        memcpy(&col, &pri.col, sizeof(col));
+        return { pri.type, col, pri.width };
+    }
+    size_t acquire(const Primitive &pri) {
+        auto key = slotKey(pri);
+        auto iter = m_free.find(key);
+        if (iter != m_free.cend() && !iter->second.empty()) {
+            auto idx = iter->second.back();
+            iter->second.pop_back();
+            return idx;
+        }
+        auto idx = m_sink.addDrawable(pri.type, pri.col, pri.width);
+        if (idx >= m_tracks.size())
+            m_tracks.resize(idx + 1);
+        m_tracks[idx].key = key;
+        return idx;
+    }
+public:
+    KeyFrameWriter(SceneSink &sink, bool changesOnly, bool recycle, const Detail &detail) :m_sink(sink), m_changesOnly(changesOnly), m_recycle(recycle), m_detail(detail) {}
+    // Whether pri is drawn at all; labels below the readable size are not.
+    bool visible(const Primitive &pri, float scale) const {
+        return !m_detail.enabled || pri.type != PrimitiveType::text || pri.size.x * scale >= m_detail.text;
+    }
+    // Records pri into drawable idx (a new or recycled drawable if invalidIdx) and returns the drawable used.
+    size_t record(size_t idx, float ts, const Frame &owner, const Primitive &pri, const PointCast &cast, float scale) {
+        auto &&frame = m_scratch;
+        fillKeyFrame(frame, ts, owner, pri, cast, scale);
+        if (m_detail.enabled)
+            reduceDetail(frame, m_detail);
+        if (idx == invalidIdx)
+            idx = acquire(pri);
+        else if (m_changesOnly && frame.sameValues(m_tracks[idx].frame)) {
+            auto &&track = m_tracks[idx];
+            track.frame.ts = ts;
+            track.held = true;
+            return idx;
+        }
+        else flush(idx);
+
+        m_sink.addKeyFrame(idx, frame);
+        auto &&track = m_tracks[idx];
+        track.frame = frame;
+        track.held = false;
+        return idx;
+    }
+    // The primitive drawn by idx is gone.
+    void release(size_t idx) {
+        flush(idx);
+        if (!m_recycle)
+            return;
+        // The drawable is shown while first.ts < ct <= last.ts. A transparent steep keyframe right after
+        // the last one keeps it invisible until it is reused, since keyframe colours are taken from the earlier keyframe.
+        auto &&track = m_tracks[idx];
+        auto hidden = track.frame;
+        hidden.ts = std::nextafter(hidden.ts, std::numeric_limits<float>::infinity());
+        hidden.hidden = true;
+        m_sink.addKeyFrame(idx, hidden);
+        m_free[track.key].push_back(idx);
+    }
+    void flush(size_t idx) {
+        auto &&track = m_tracks[idx];
+        if (track.held) {
+            m_sink.addKeyFrame(idx, track.frame);
+            track.held = false;
+        }
+    }
+};
+
+void LayoutContext::renderFrames(Json &drawables, const std::vector<std::pair<float, Frame>> &frames, float width, float height, const RenderOptions &options) const {
+    JsonDomSink sink(drawables);
+    renderFrames(sink, frames, width, height, options);
+}
+
+// Keeps what one partition of renderFrames writes, for replaying it in partition order.
+class RecordingSink final :public SceneSink {
+private:
+    struct Drawable final {
+        PrimitiveType type;
+        RGBA col;
+        float width;
+        std::vector<KeyFrame> frames;
+    };
+    std::vector<Drawable> m_drawables;
+public:
+    size_t addDrawable(PrimitiveType type, const RGBA &col, float width) override {
+        m_drawables.push_back({ type, col, width, {} });
+        return m_drawables.size() - 1;
+    }
+    void addKeyFrame(size_t drawable, const KeyFrame &frame) override {
+        m_drawables[drawable].frames.push_back(frame);
+    }
+    void replay(SceneSink &sink) const {
+        for (auto &&drawable : m_drawables) {
+            auto idx = sink.addDrawable(drawable.type, drawable.col, drawable.width);
+            for (auto &&frame : drawable.frames)
+                sink.addKeyFrame(idx, frame);
+        }
+    }
+};
 
-            for (auto &&buk2 : pris) {
-                auto t = buk2.first;
-                auto &&buk = buk2.second;
+struct View final {
+    float scale;
+    glm::vec2 offset;
+};
 
-                const std::remove_reference_t<decltype(buk)> *cmp2 = &empty;
-                if (cmp1) {
-                    auto iter = cmp1->find(t);
-                    if (iter != cmp1->cend())
-                        cmp2 = &iter->second;
-                }
+// Diffs consecutive frames and records the primitives whose ids lie in [lo, hi).
+static void renderRange(SceneSink &sink, const std::vector<std::pair<float, Frame>> &frames, const std::vector<View> &views, const RenderOptions &options, const Detail &detail, uint64_t lo, uint64_t hi) {
+    KeyFrameWriter writer(sink, options.changesOnly, options.recycleDrawables, detail);
+    auto idLess = [] (const Primitive &pri, uint64_t id) {return pri.id < id; };
+    const Primitive *last = nullptr, *lastEnd = nullptr;
+    // Drawable index of every primitive in the last and the current frame.
+    std::vector<size_t> lastIdx, curIdx;
+    std::vector<bool> matched;
+    for (size_t f = 0; f < frames.size(); ++f) {
+        auto ts = frames[f].first;
+        const Frame &frame = frames[f].second;
+        auto scale = views[f].scale;
+        auto offset = views[f].offset;
+        PointCast cast = [offset, scale] (const glm::vec2 &p) {return p * scale + offset; };
 
-                for (size_t i = 0; i < std::min(buk.size(), cmp2->size()); ++i)
-                    buk[i]->record(drawables, (*cmp2)[i]->jsonIdx, ts, cast, scale);
+        auto pris = frame.pris.data() + (std::lower_bound(frame.pris.cbegin(), frame.pris.cend(), lo, idLess) - frame.pris.cbegin());
+        auto prisEnd = frame.pris.data() + (std::lower_bound(frame.pris.cbegin(), frame.pris.cend(), hi, idLess) - frame.pris.cbegin());
+        size_t count = prisEnd - pris, lastCount = lastEnd - last;
 
-                for (size_t i = cmp2->size(); i < buk.size(); ++i)
-                    buk[i]->record(drawables, invalidIdx, ts, cast, scale);
+        // Merge-join both frames on (id, type); within a group, primitives are matched by drawing order.
+        curIdx.assign(count, invalidIdx);
+        matched.assign(lastCount, false);
+        auto groupEnd = [] (const Primitive *vec, size_t size, size_t beg) {
+            size_t end = beg;
+            while (end < size && !primitiveLess(vec[beg], vec[end]))
+                ++end;
+            return end;
+        };
+        for (size_t i = 0, j = 0; i < count;) {
+            while (j < lastCount && primitiveLess(last[j], pris[i]))
+                ++j;
+            size_t ie = groupEnd(pris, count, i);
+            size_t je = (j < lastCount && !primitiveLess(pris[i], last[j]) ? groupEnd(last, lastCount, j) : j);
+            for (size_t k = 0; k < ie - i && j + k < je; ++k) {
+                curIdx[i + k] = lastIdx[j + k];
+                matched[j + k] = true;
             }
+            i = ie;
+            j = je;
         }
+        // Vanished and hidden primitives go first, so that their drawables can be reused within this frame.
+        for (size_t i = 0; i < count; ++i)
+            if (curIdx[i] != invalidIdx && !writer.visible(pris[i], scale)) {
+                writer.release(curIdx[i]);
+                curIdx[i] = invalidIdx;
+            }
+        for (size_t j = 0; j < lastCount; ++j)
+            if (!matched[j] && lastIdx[j] != invalidIdx)
+                writer.release(lastIdx[j]);
+        for (size_t i = 0; i < count; ++i)
+            if (writer.visible(pris[i], scale))
+                curIdx[i] = writer.record(curIdx[i], ts, frame, pris[i], cast, scale);
 
-        lastFrame = &frame;
+        last = pris;
+        lastEnd = prisEnd;
+        lastIdx.swap(curIdx);
     }
+    for (auto idx : lastIdx)
+        if (idx != invalidIdx)
+            writer.flush(idx);
+}
+
+void LayoutContext::renderFrames(SceneSink &sink, const std::vector<std::pair<float, Frame>> &frames, float width, float height, const RenderOptions &options) const {
+    float r1 = width / height;
+
+    glm::vec2 viewport = { 0.0f, 0.0f };
+    for (auto &&fr : frames)
+        viewport = glm::max(viewport, fr.second.size);
+
+    std::vector<View> views;
+    for (auto &&fr : frames) {
+        auto size = (options.fixedViewport ? viewport : fr.second.size);
+        float dw = size.x, dh = size.y;
+        float r2 = size.x / size.y;
+
+        float scale = (r2 > r1 ? (width / dw) : height / dh);
+        dw *= scale; dh *= scale;
+        views.push_back({ scale, { (width - dw) * 0.5f, (height - dh) * 0.5f } });
+    }
+
+    // One output pixel in scene units, with the scene fitted to the output like the renderer does.
+    auto &&lod = options.lod;
+    float pixel = 1.0f / std::min(lod.resolution.x / width, lod.resolution.y / height);
+    Detail detail = { lod.enabled, lod.pointSize * pixel, lod.curveTolerance * pixel, lod.minTextSize * pixel };
+
+    /*
+    Objects are independent, so ids are cut into ranges of similar primitive counts that are
+    diffed in parallel and replayed in range order. The cuts only depend on the frames, which
+    keeps the output the same for any number of threads.
+    */
+    std::vector<uint64_t> ids;
+    for (auto &&fr : frames)
+        for (auto &&pri : fr.second.pris)
+            ids.push_back(pri.id);
+    std::sort(ids.begin(), ids.end());
+    size_t parts = std::clamp<size_t>(ids.size() / 4096, 1, 64);
+    std::vector<uint64_t> cuts = { 0 };
+    for (size_t k = 1; k < parts; ++k) {
+        auto cut = ids[ids.size() * k / parts];
+        if (cut > cuts.back())
+            cuts.push_back(cut);
+    }
+    cuts.push_back(std::numeric_limits<uint64_t>::max());
+    parts = cuts.size() - 1;
+
+    if (parts == 1 || options.threads <= 1) {
+        for (size_t k = 0; k < parts; ++k)
+            renderRange(sink, frames, views, options, detail, cuts[k], cuts[k + 1]);
+    }
+    else {
+        std::vector<RecordingSink> records(parts);
+        std::atomic<size_t> next(0);
+        auto worker = [&] {
+            for (size_t k; (k = next++) < parts;)
+                renderRange(records[k], frames, views, options, detail, cuts[k], cuts[k + 1]);
+        };
+        std::vector<std::thread> pool;
+        for (size_t t = 0; t < std::min(options.threads, parts); ++t)
+            pool.emplace_back(worker);
+        for (auto &&thread : pool)
+            thread.join();
+        for (auto &&record : records)
+            record.replay(sink);
+    }
+    sink.finish();
 }
 
 LayoutContext::~LayoutContext() {
-    gvFinalize(m_context);
-    gvFreeContext(m_context);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_ready.notify_all();
+    for (auto &&worker : m_pool)
+        worker.join();
+    freeContext(m_context);
 }
 
-Graph::Graph(LayoutContext &context, const std::string &name, bool directed) :m_context(context) {
+Graph::Graph(LayoutContext &context, const std::string &name, bool directed, const LayoutOptions &options) :m_context(context), m_warmStart(options.warmStart), m_open(false) {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
     Agdesc_t desc;
     memset(&desc, 0, sizeof(desc));
     desc.directed = directed;
     m_graph = agopen(const_cast<char *>(name.c_str()), desc, nullptr);
+
+    // Kept as graph attributes so that snapshots and the layout memo see them.
+    auto set = [this] (const char *key, const std::string &val) {
+        if (!val.empty())
+            agattr(m_graph, AGRAPH, const_cast<char *>(key), val.c_str());
+    };
+    set("layout", options.engine);
+    set("overlap", options.overlap);
+    set("splines", options.splines);
+    if (options.maxIter > 0)
+        set("maxiter", std::to_string(options.maxIter));
+    m_committed = hashGraph(m_graph);
 }
 
 Graph::~Graph() {
+    m_context.forget(m_graph);
+    std::lock_guard<std::mutex> lock(graphvizMutex);
     agclose(m_graph);
 }
 
+void Graph::log(Edit::Kind kind, void *obj, const char *key, const char *value) {
+    if (m_open)
+        m_pending.push_back({ kind, AGID(obj), key, value });
+}
+
 Agnode_t *Graph::allocNode() {
-    return agnode(m_graph, nullptr, 1);
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    auto node = agnode(m_graph, nullptr, 1);
+    log(Edit::Kind::addNode, node);
+    return node;
 }
 
 Agedge_t *Graph::linkEdge(Agnode_t *a, Agnode_t *b) {
-    return agedge(m_graph, a, b, nullptr, 1);
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    auto edge = agedge(m_graph, a, b, nullptr, 1);
+    log(Edit::Kind::addEdge, edge);
+    return edge;
 }
 
 void Graph::removeObject(ObjectHandle obj) {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    log(Edit::Kind::remove, obj);
     agdelete(m_graph, obj);
 }
 
 void Graph::setColor(ObjectHandle obj, const char *col) {
-    agset(obj, "color", const_cast<char *>(col));
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    log(Edit::Kind::setAttr, obj, "color", col);
+    agsafeset(obj, const_cast<char *>("color"), const_cast<char *>(col), const_cast<char *>("black"));
 }
 
-Frame Graph::recordKeyFrame() {
-    return m_context.render(m_graph);
+void Graph::setLabel(ObjectHandle obj, const char *label) {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    log(Edit::Kind::setAttr, obj, "label", label);
+    // Nodes show their name by default, edges nothing.
+    agsafeset(obj, const_cast<char *>("label"), const_cast<char *>(label), const_cast<char *>(agobjkind(obj) == AGNODE ? "\\N" : ""));
 }
 
-Json Primitive::init() const {
-    Json base;
-    base["color"] = rgba2Json(m_col);
-    base["width"] = m_width;
-    base["type"] = m_type;
-    return base;
+void Graph::setCluster(Agnode_t *node, const std::string &name) {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    log(Edit::Kind::setAttr, node, "cluster", name.c_str());
+    agsafeset(node, const_cast<char *>("cluster"), const_cast<char *>(name.c_str()), const_cast<char *>(""));
 }
 
-Primitive::Primitive(obj_state_t *style, const std::string &type) :m_width(static_cast<float>(style->penwidth)), m_type(type), jsonIdx(invalidIdx) {
-    assert(style->pencolor.type == color_type_t::RGBA_BYTE);
-    static_assert(sizeof(RGBA) == 4);
-    memcpy(&m_col, style->pencolor.u.rgba, sizeof(m_col));
+Snapshot Graph::snapshot() const {
+    return Snapshot(m_graph);
+}
+
+void Graph::setPinned(Agnode_t *node, bool pinned) {
+    std::lock_guard<std::mutex> lock(graphvizMutex);
+    log(Edit::Kind::setAttr, node, "pin", pinned ? "true" : "false");
+    agsafeset(node, const_cast<char *>("pin"), const_cast<char *>(pinned ? "true" : "false"), const_cast<char *>("false"));
+}
+
+void Graph::begin() {
+    assert(!m_open);
+    m_open = true;
 }
 
-void Primitive::record(Json &drawables, size_t idx, float ts, const PointCast &cast, float scale) const {
-    if (idx == invalidIdx) {
-        idx = drawables.size();
-        drawables.push_back(init());
+bool Graph::commit(float ts) {
+    assert(m_open);
+    m_open = false;
+    auto edits = std::move(m_pending);
+    m_pending.clear();
+    if (edits.empty())
+        return false;
+    // Edits that cancel out (say, recolouring a node back) leave nothing to lay out.
+    uint64_t hash;
+    {
+        std::lock_guard<std::mutex> lock(graphvizMutex);
+        hash = hashGraph(m_graph);
     }
+    if (hash == m_committed)
+        return false;
+    m_committed = hash;
+    m_journal.push_back({ ts, std::move(edits) });
+    enqueueKeyFrame(ts);
+    return true;
+}
 
-    jsonIdx = idx;
+const std::vector<Transaction> &Graph::journal() const {
+    return m_journal;
+}
 
-    Json frame;
-    frame["ts"] = ts;
-    record(frame, cast, scale);
-    drawables[idx]["frame"].push_back(frame);
+Frame Graph::recordKeyFrame() {
+    return m_context.render(m_graph, m_warmStart);
 }
 
-Primitive::~Primitive() {}
+void Graph::enqueueKeyFrame(float ts) {
+    m_context.enqueue(ts, snapshot(), m_warmStart);
+}
@@ -2,6 +2,12 @@
 #include <nlohmann/json.hpp>
 #include <map>
 #include <vector>
+#include <filesystem>
+#include <deque>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <glm/glm.hpp>
 using Json = nlohmann::json;
 
@@ -10,7 +16,6 @@ typedef struct GVC_s GVC_t;
 typedef struct Agraph_s Agraph_t;
 typedef struct Agnode_s Agnode_t;
 typedef struct Agedge_s Agedge_t;
-typedef struct obj_state_s obj_state_t;
 
 enum class PrimitiveType {
     text, curve, polygon, polyline, ellipse
@@ -22,48 +27,270 @@ struct RGBA {
     unsigned char r, g, b, a;
 };
 
-class Primitive {
-public:
-    RGBA m_col;
-    float m_width;
-    std::string m_type;
-protected:
-    virtual Json init() const;
-    Primitive(obj_state_t *style, const std::string &type);
-    virtual void record(Json &frames, const PointCast &cast, float scale) const = 0;
-public:
-    mutable size_t jsonIdx;
-    void record(Json &drawables, size_t idx, float ts, const PointCast &cast, float scale) const;
-    virtual ~Primitive();
+// One GraphViz drawing call. Vertices and text live in the pools of the owning Frame.
+struct Primitive final {
+    uint64_t id;
+    PrimitiveType type;
+    RGBA col;
+    float width;
+    // Ellipse center and radii; text center, with the font size in size.x.
+    glm::vec2 pos, size;
+    uint32_t vertBegin, vertCount;
+    uint32_t textBegin, textCount;
+};
+
+struct NodePos final {
+    uint64_t id;
+    glm::vec2 pos;
 };
 
 struct Frame final {
     glm::vec2 size;
-    std::map < uint64_t, std::map<PrimitiveType, std::vector< std::shared_ptr<Primitive>>>> pris;
+    // Sorted by (id, type). Primitives of one object and type keep their drawing order.
+    std::vector<Primitive> pris;
+    std::vector<glm::vec2> verts;
+    std::string text;
+    // Laid out position of every node in points, sorted by node id.
+    std::vector<NodePos> nodes;
+};
+
+// One keyframe of a graph drawable, in scene coordinates. Which fields are set depends on type.
+struct KeyFrame final {
+    float ts;
+    PrimitiveType type;
+    // Text and Ellipse
+    glm::vec2 center;
+    // Ellipse
+    glm::vec2 radius;
+    // Text
+    float size;
+    std::string text;
+    // Bezierline, Polygon and Polyline
+    std::vector<glm::vec2> verts;
+    // Ends a drawable until it is reused: a steep keyframe with a transparent colour.
+    bool hidden;
+
+    // Equal up to the time stamp.
+    bool sameValues(const KeyFrame &rhs) const;
+};
+
+// Receives the drawables of a graph animation in the scene format.
+class SceneSink {
+public:
+    // Returns the index of the new drawable.
+    virtual size_t addDrawable(PrimitiveType type, const RGBA &col, float width) = 0;
+    // Keyframes of one drawable arrive in time order.
+    virtual void addKeyFrame(size_t drawable, const KeyFrame &frame) = 0;
+    virtual void finish() {}
+    virtual ~SceneSink();
+};
+
+// Appends to a drawables array of a JSON document.
+class JsonDomSink final :public SceneSink {
+private:
+    Json &m_drawables;
+public:
+    explicit JsonDomSink(Json &drawables);
+    size_t addDrawable(PrimitiveType type, const RGBA &col, float width) override;
+    void addKeyFrame(size_t drawable, const KeyFrame &frame) override;
+};
+
+/*
+Writes the scene as JSON text without building a DOM. The format lists every keyframe of a
+drawable together, so keyframes are serialized into a compact buffer per drawable and the
+scene (header fields plus drawables) goes to the stream on finish().
+*/
+class JsonStreamSink final :public SceneSink {
+private:
+    std::ostream &m_out;
+    std::string m_header;
+    std::vector<std::string> m_drawables;
+    std::vector<bool> m_empty;
+    static void writeNumber(std::string &buf, float val);
+    static void writePoint(std::string &buf, const glm::vec2 &p);
+public:
+    // header holds the scene fields other than drawables.
+    JsonStreamSink(std::ostream &out, const Json &header);
+    size_t addDrawable(PrimitiveType type, const RGBA &col, float width) override;
+    void addKeyFrame(size_t drawable, const KeyFrame &frame) override;
+    void finish() override;
+};
+
+// Reduces primitives that are too small to see at the output resolution; sizes are in output pixels.
+struct LevelOfDetail final {
+    bool enabled = false;
+    glm::vec2 resolution = { 1920.0f, 1080.0f };
+    // Nodes smaller than this are drawn as points of this size.
+    float pointSize = 1.0f;
+    // Curves are simplified while they stay this close to the original.
+    float curveTolerance = 0.5f;
+    // Labels with smaller fonts are dropped.
+    float minTextSize = 4.0f;
+};
+
+struct RenderOptions final {
+    // Fit the union of all frame sizes once instead of fitting every frame on its own.
+    bool fixedViewport = false;
+    // Skip keyframes equal to the previous one, holding the value until it changes.
+    bool changesOnly = true;
+    // Hand drawables of vanished primitives to later primitives of the same type, colour and width.
+    bool recycleDrawables = true;
+    // Threads diffing disjoint ranges of object ids; the output does not depend on it.
+    size_t threads = std::thread::hardware_concurrency();
+    LevelOfDetail lod;
+};
+
+// Seeds force-directed engines (neato, fdp, sfdp) with the node positions of the previous layout of the same graph.
+struct WarmStart final {
+    bool enabled = false;
+    // Keep nodes of the previous layout in place, so that only new nodes move.
+    bool pinExisting = false;
+    // Iteration cap for seeded layouts unless the graph sets maxiter itself.
+    int maxIter = 50;
+};
+
+// Graph attributes controlling the layout; empty or zero values keep the engine's defaults.
+struct LayoutOptions final {
+    // dot, neato, fdp, sfdp, ...; sfdp is the multilevel engine for large graphs and tree the built-in tidy tree layout.
+    std::string engine = "dot";
+    std::string overlap;
+    std::string splines;
+    int maxIter = 0;
+    WarmStart warmStart;
+};
+
+struct EngineStats final {
+    size_t layouts;
+    double seconds;
+};
+
+struct LayoutStats final {
+    size_t hits, misses, diskHits;
+    // Cluster layouts reused and computed.
+    size_t clusterHits, clusterMisses;
+    std::map<std::string, EngineStats> engines;
+};
+
+// A private copy of a graph at one point of its edit history, with the same object ids and attributes.
+class Snapshot final {
+private:
+    Agraph_t *m_source;
+    Agraph_t *m_graph;
+public:
+    explicit Snapshot(Agraph_t *source);
+    Snapshot(Snapshot &&rhs) noexcept;
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+    Snapshot &operator=(Snapshot &&) = delete;
+    Agraph_t *source() const;
+    Agraph_t *graph() const;
+    ~Snapshot();
 };
 
+class DiskCache;
+
 class LayoutContext final {
 private:
+    struct Memo final {
+        uint64_t hash;
+        std::shared_future<Frame> frame;
+    };
     GVC_t *m_context;
+    std::map<Agraph_t *, Memo> m_memo;
+    LayoutStats m_stats;
+    mutable std::mutex m_statsMutex;
+
+    // Each worker owns its GVC_t; GraphViz calls still run one at a time.
+    size_t m_workers;
+    std::vector<std::thread> m_pool;
+    std::deque<std::function<void(GVC_t *)>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    bool m_stop;
+    std::vector<std::pair<float, std::shared_future<Frame>>> m_queued;
+    std::unique_ptr<DiskCache> m_disk;
+
+    // Node positions of a cluster around its center, and the size of its box.
+    struct ClusterLayout final {
+        std::vector<NodePos> nodes;
+        glm::vec2 size;
+    };
+    std::map<uint64_t, ClusterLayout> m_clusters;
+    std::mutex m_clusterMutex;
+
+    void countHit(bool hit);
+    bool placeClusters(GVC_t *gvc, Agraph_t *g, const char *engine);
+    Frame layout(GVC_t *gvc, Agraph_t *g, const Frame *seed, const WarmStart &warm);
+    void work();
 public:
-    explicit LayoutContext();
-    Frame render(Agraph_t *g);
-    void renderFrames(Json &drawables, const std::vector<std::pair<float, Frame>> &frames, float width, float height) const;
+    // Every GraphViz call (graph edits, snapshots, layouts) is serialized behind one process-wide lock, so layouts
+    // never run concurrently. Workers take them off the calling thread; more than one only overlaps disk cache reads.
+    explicit LayoutContext(size_t workers = 1);
+    // Reuses the previous frame of g when neither its structure nor its attributes changed.
+    Frame render(Agraph_t *g, const WarmStart &warm = WarmStart());
+    // Lays the snapshot out on the worker pool. The frame is returned by the next collect().
+    void enqueue(float ts, Snapshot snapshot, const WarmStart &warm = WarmStart());
+    // Waits for all enqueued layouts and returns their frames in timestamp order.
+    std::vector<std::pair<float, Frame>> collect();
+    // Keeps layouts in dir across runs, dropping the least recently used ones beyond maxBytes. Call before laying out anything.
+    void setDiskCache(const std::filesystem::path &dir, uintmax_t maxBytes = 256u << 20);
+    void forget(Agraph_t *g);
+    // TrueType font whose metrics size every label (consola.ttf, as in the renderer, by default); set it before laying out.
+    static void setFont(const std::filesystem::path &path);
+    LayoutStats stats() const;
+    void renderFrames(SceneSink &sink, const std::vector<std::pair<float, Frame>> &frames, float width, float height, const RenderOptions &options = RenderOptions()) const;
+    void renderFrames(Json &drawables, const std::vector<std::pair<float, Frame>> &frames, float width, float height, const RenderOptions &options = RenderOptions()) const;
     ~LayoutContext();
 };
 
+struct Edit final {
+    enum class Kind {
+        addNode, addEdge, remove, setAttr
+    } kind;
+    uint64_t id;
+    std::string key, value;
+};
+
+struct Transaction final {
+    float ts;
+    std::vector<Edit> edits;
+};
+
 class Graph final {
 private:
     LayoutContext &m_context;
     Agraph_t *m_graph;
+    WarmStart m_warmStart;
+
+    // Edits of the open transaction, and every transaction committed so far.
+    bool m_open;
+    std::vector<Edit> m_pending;
+    std::vector<Transaction> m_journal;
+    uint64_t m_committed;
+
+    void log(Edit::Kind kind, void *obj, const char *key = "", const char *value = "");
 public:
-    explicit Graph(LayoutContext &context, const std::string &name, bool directed);
+    explicit Graph(LayoutContext &context, const std::string &name, bool directed, const LayoutOptions &options = LayoutOptions());
     ~Graph();
     Agnode_t *allocNode();
     Agedge_t *linkEdge(Agnode_t *a, Agnode_t *b);
     void removeObject(ObjectHandle obj);
 
     void setColor(ObjectHandle obj, const char *col);
+    void setLabel(ObjectHandle obj, const char *label);
+    // Keeps a node at its seeded position in warm-started layouts.
+    void setPinned(Agnode_t *node, bool pinned);
+    // Nodes with the same non-empty name are laid out together, apart from the rest, and placed as one box;
+    // an edit only lays out its own cluster again.
+    void setCluster(Agnode_t *node, const std::string &name);
+
+    // Groups the following edits into one keyframe.
+    void begin();
+    // Closes the transaction and enqueues a keyframe at ts, unless the graph ends up as it was at the last commit. Returns whether it did.
+    bool commit(float ts);
+    const std::vector<Transaction> &journal() const;
 
+    Snapshot snapshot() const;
     Frame recordKeyFrame();
+    void enqueueKeyFrame(float ts);
 };
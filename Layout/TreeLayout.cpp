@@ -0,0 +1,199 @@
+#include "TreeLayout.hpp"
+#include <algorithm>
+
+namespace {
+    struct TreeNode final {
+        size_t parent, number;
+        size_t thread, ancestor;
+        std::vector<size_t> children;
+        double prelim, mod, shift, change;
+    };
+
+    // Walker's passes over an explicit tree. Every walk is iterative so that deep trees cannot overflow the stack,
+    // and positions are accumulated in double since wide trees reach millions of points.
+    class TidyTree final {
+    private:
+        std::vector<TreeNode> m_nodes;
+        const std::vector<float> &m_widths;
+        float m_sep;
+
+        double distance(size_t a, size_t b) const {
+            auto width = [this] (size_t v) {return v < m_widths.size() ? m_widths[v] : 0.0f; };
+            return (width(a) + width(b)) * 0.5 + m_sep;
+        }
+        size_t nextLeft(size_t v) const {
+            auto &&node = m_nodes[v];
+            return node.children.empty() ? node.thread : node.children.front();
+        }
+        size_t nextRight(size_t v) const {
+            auto &&node = m_nodes[v];
+            return node.children.empty() ? node.thread : node.children.back();
+        }
+        size_t leftSibling(size_t v) const {
+            auto &&node = m_nodes[v];
+            return node.number ? m_nodes[node.parent].children[node.number - 1] : noParent;
+        }
+        void moveSubtree(size_t wm, size_t wp, double shift) {
+            double subtrees = static_cast<double>(m_nodes[wp].number - m_nodes[wm].number);
+            m_nodes[wp].change -= shift / subtrees;
+            m_nodes[wp].shift += shift;
+            m_nodes[wm].change += shift / subtrees;
+            m_nodes[wp].prelim += shift;
+            m_nodes[wp].mod += shift;
+        }
+        void executeShifts(size_t v) {
+            double shift = 0.0, change = 0.0;
+            auto &&children = m_nodes[v].children;
+            for (auto iter = children.rbegin(); iter != children.rend(); ++iter) {
+                auto &&w = m_nodes[*iter];
+                w.prelim += shift;
+                w.mod += shift;
+                change += w.change;
+                shift += w.shift + change;
+            }
+        }
+        size_t apportion(size_t v, size_t defaultAncestor) {
+            auto w = leftSibling(v);
+            if (w == noParent)
+                return defaultAncestor;
+            size_t vip = v, vop = v, vim = w, vom = m_nodes[m_nodes[v].parent].children.front();
+            double sip = m_nodes[vip].mod, sop = m_nodes[vop].mod, sim = m_nodes[vim].mod, som = m_nodes[vom].mod;
+            while (nextRight(vim) != noParent && nextLeft(vip) != noParent) {
+                vim = nextRight(vim);
+                vip = nextLeft(vip);
+                vom = nextLeft(vom);
+                vop = nextRight(vop);
+                m_nodes[vop].ancestor = v;
+                double shift = (m_nodes[vim].prelim + sim) - (m_nodes[vip].prelim + sip) + distance(vim, vip);
+                if (shift > 0.0) {
+                    auto anc = m_nodes[vim].ancestor;
+                    moveSubtree(m_nodes[anc].parent == m_nodes[v].parent ? anc : defaultAncestor, v, shift);
+                    sip += shift;
+                    sop += shift;
+                }
+                sim += m_nodes[vim].mod;
+                sip += m_nodes[vip].mod;
+                som += m_nodes[vom].mod;
+                sop += m_nodes[vop].mod;
+            }
+            if (nextRight(vim) != noParent && nextRight(vop) == noParent) {
+                m_nodes[vop].thread = nextRight(vim);
+                m_nodes[vop].mod += sim - sop;
+            }
+            if (nextLeft(vip) != noParent && nextLeft(vom) == noParent) {
+                m_nodes[vom].thread = nextLeft(vip);
+                m_nodes[vom].mod += sip - som;
+                defaultAncestor = v;
+            }
+            return defaultAncestor;
+        }
+        // Called once all children of v are placed, and after every left sibling of v.
+        void finish(size_t v, std::vector<size_t> &defaultAncestor) {
+            auto &&node = m_nodes[v];
+            auto ls = (node.parent == noParent ? noParent : leftSibling(v));
+            if (node.children.empty())
+                node.prelim = (ls == noParent ? 0.0 : m_nodes[ls].prelim + distance(ls, v));
+            else {
+                executeShifts(v);
+                double midpoint = (m_nodes[node.children.front()].prelim + m_nodes[node.children.back()].prelim) * 0.5;
+                if (ls == noParent)
+                    node.prelim = midpoint;
+                else {
+                    node.prelim = m_nodes[ls].prelim + distance(ls, v);
+                    node.mod = node.prelim - midpoint;
+                }
+            }
+            if (node.parent != noParent)
+                defaultAncestor[node.parent] = apportion(v, defaultAncestor[node.parent]);
+        }
+    public:
+        TidyTree(std::vector<TreeNode> nodes, const std::vector<float> &widths, float sep) :m_nodes(std::move(nodes)), m_widths(widths), m_sep(sep) {}
+
+        // First walk in post-order, children left to right.
+        void firstWalk(size_t root) {
+            std::vector<size_t> defaultAncestor(m_nodes.size(), noParent);
+            std::vector<std::pair<size_t, size_t>> stack = { { root, 0 } };
+            while (!stack.empty()) {
+                auto &&top = stack.back();
+                auto v = top.first;
+                auto &&children = m_nodes[v].children;
+                if (top.second == 0 && !children.empty())
+                    defaultAncestor[v] = children.front();
+                if (top.second < children.size())
+                    stack.emplace_back(children[top.second++], 0);
+                else {
+                    stack.pop_back();
+                    finish(v, defaultAncestor);
+                }
+            }
+        }
+
+        // Second walk in pre-order, accumulating the modifiers of the ancestors.
+        void secondWalk(size_t root, std::vector<double> &xs, std::vector<size_t> &depths) const {
+            std::vector<std::pair<size_t, double>> stack = { { root, 0.0 } };
+            while (!stack.empty()) {
+                auto v = stack.back().first;
+                auto m = stack.back().second;
+                stack.pop_back();
+                auto &&node = m_nodes[v];
+                xs[v] = node.prelim + m;
+                for (auto w : node.children) {
+                    depths[w] = depths[v] + 1;
+                    stack.emplace_back(w, m + node.mod);
+                }
+            }
+        }
+    };
+}
+
+std::vector<glm::vec2> layoutTree(const std::vector<size_t> &parent, const std::vector<float> &widths, const TreeSpacing &spacing) {
+    size_t n = parent.size();
+    if (!n)
+        return {};
+
+    // Roots become the children of a virtual root n, which has no width.
+    std::vector<TreeNode> nodes(n + 1);
+    for (size_t v = 0; v <= n; ++v) {
+        auto &&node = nodes[v];
+        node.parent = (v == n ? noParent : (parent[v] == noParent ? n : parent[v]));
+        node.number = 0;
+        node.thread = noParent;
+        node.ancestor = v;
+        node.prelim = node.mod = node.shift = node.change = 0.0;
+    }
+    for (size_t v = 0; v < n; ++v) {
+        auto p = nodes[v].parent;
+        if (p > n)
+            return {};
+        nodes[v].number = nodes[p].children.size();
+        nodes[p].children.push_back(v);
+    }
+
+    // A forest reaches every node from the virtual root; a cycle cannot be reached.
+    size_t reached = 0;
+    std::vector<size_t> stack = { n };
+    while (!stack.empty()) {
+        auto v = stack.back();
+        stack.pop_back();
+        ++reached;
+        for (auto w : nodes[v].children)
+            stack.push_back(w);
+    }
+    if (reached != n + 1)
+        return {};
+
+    TidyTree tree(std::move(nodes), widths, spacing.siblingSep);
+    tree.firstWalk(n);
+    std::vector<double> xs(n + 1);
+    std::vector<size_t> depths(n + 1, 0);
+    tree.secondWalk(n, xs, depths);
+
+    double left = std::numeric_limits<double>::max();
+    for (size_t v = 0; v < n; ++v)
+        left = std::min(left, xs[v] - (v < widths.size() ? widths[v] : 0.0f) * 0.5);
+
+    std::vector<glm::vec2> res(n);
+    for (size_t v = 0; v < n; ++v)
+        res[v] = { static_cast<float>(xs[v] - left), (depths[v] - 1) * spacing.rankSep };
+    return res;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <glm/glm.hpp>
+
+constexpr auto noParent = std::numeric_limits<size_t>::max();
+
+struct TreeSpacing final {
+    // Gap between neighbouring subtrees and distance between ranks, in points.
+    float siblingSep = 18.0f;
+    float rankSep = 72.0f;
+};
+
+/*
+Tidy tree layout (Walker's algorithm in the linear-time form of Buchheim, Juenger and Leipert).
+parent[v] is the parent of node v or noParent for a root; children keep their index order and
+several roots are placed side by side. widths[v] is the horizontal extent of node v. Returns the
+center of every node, with roots at y = 0 and y growing downwards, or an empty vector if parent
+does not describe a forest.
+*/
+std::vector<glm::vec2> layoutTree(const std::vector<size_t> &parent, const std::vector<float> &widths, const TreeSpacing &spacing = TreeSpacing());
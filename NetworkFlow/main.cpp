@@ -1,50 +1,214 @@
 #include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <string>
 #include <nlohmann/json.hpp>
 #include "../Layout/Layout.hpp"
 using Json = nlohmann::json;
 
+constexpr auto none = std::numeric_limits<size_t>::max();
+
+/*
+Dinic's algorithm on flat arrays: arcs are stored in pairs, so arc a ^ 1 is the reverse of arc a,
+and adjacency lists are threaded through m_next. Augmenting paths are searched iteratively, so
+long level graphs cannot overflow the stack.
+*/
+class MaxFlow final {
+private:
+    std::vector<size_t> m_head, m_next, m_to, m_level, m_iter;
+    std::vector<int64_t> m_cap;
+
+    bool buildLevels(size_t s, size_t t) {
+        std::fill(m_level.begin(), m_level.end(), none);
+        std::vector<size_t> queue = { s };
+        m_level[s] = 0;
+        for (size_t i = 0; i < queue.size(); ++i) {
+            auto v = queue[i];
+            for (auto a = m_head[v]; a != none; a = m_next[a])
+                if (m_cap[a] > 0 && m_level[m_to[a]] == none) {
+                    m_level[m_to[a]] = m_level[v] + 1;
+                    queue.push_back(m_to[a]);
+                }
+        }
+        return m_level[t] != none;
+    }
+public:
+    explicit MaxFlow(size_t n) :m_head(n, none), m_level(n), m_iter(n) {}
+
+    // Returns the index of the forward arc.
+    size_t addEdge(size_t u, size_t v, int64_t cap) {
+        auto add = [this] (size_t from, size_t to, int64_t c) {
+            m_next.push_back(m_head[from]);
+            m_head[from] = m_to.size();
+            m_to.push_back(to);
+            m_cap.push_back(c);
+        };
+        add(u, v, cap);
+        add(v, u, 0);
+        return m_to.size() - 2;
+    }
+    // Flow on a forward arc, i.e. the residual capacity of its reverse.
+    int64_t flow(size_t arc) const {
+        return m_cap[arc ^ 1];
+    }
+    // Starts a phase; false once t cannot be reached.
+    bool beginPhase(size_t s, size_t t) {
+        if (!buildLevels(s, t))
+            return false;
+        m_iter = m_head;
+        return true;
+    }
+    // Pushes flow along one path of the level graph and returns it, or 0 once the phase is blocked.
+    int64_t augment(size_t s, size_t t) {
+        std::vector<size_t> path;
+        auto v = s;
+        while (true) {
+            if (v == t) {
+                int64_t f = std::numeric_limits<int64_t>::max();
+                for (auto a : path)
+                    f = std::min(f, m_cap[a]);
+                for (auto a : path) {
+                    m_cap[a] -= f;
+                    m_cap[a ^ 1] += f;
+                }
+                return f;
+            }
+            auto &&a = m_iter[v];
+            while (a != none && !(m_cap[a] > 0 && m_level[m_to[a]] == m_level[v] + 1))
+                a = m_next[a];
+            if (a != none) {
+                path.push_back(a);
+                v = m_to[a];
+                continue;
+            }
+            // Dead end: no later path of this phase passes v.
+            m_level[v] = none;
+            if (path.empty())
+                return 0;
+            v = m_to[path.back() ^ 1];
+            path.pop_back();
+        }
+    }
+    // Whether v can be reached from s in the residual graph of the last phase.
+    bool sourceSide(size_t v) const {
+        return m_level[v] != none;
+    }
+};
 
 constexpr auto width = 1000.0f, height = 500.0f, step = 1.0f;
-int main() {
+// Inserting edges takes at most this many keyframes.
+constexpr size_t buildFrames = 50;
+
+int main(int argc, char **argv) {
+    LayoutOptions layout;
+    if (argc > 1)
+        layout.engine = argv[1];
+    if (layout.engine != "dot") {
+        layout.overlap = "prism";
+        layout.warmStart.enabled = true;
+    }
+    // Keyframe every k-th augmenting path; 0 takes one per phase (level graph).
+    size_t pathsPerFrame = (argc > 3 ? std::stoul(argv[3]) : 0);
+
     std::ifstream in("netflow.in");
     size_t n, m, s, t;
     in >> n >> m >> s >> t;
 
     LayoutContext ctx;
-    Graph g(ctx, "netflow", true);
+    if (argc > 2)
+        ctx.setDiskCache(argv[2]);
+    Graph g(ctx, "netflow", true, layout);
     float dur = 0.0f;
-    std::vector<std::pair<float, Frame>> frames;
-    auto render = [&] {
-        dur += step;
-        frames.emplace_back(dur, g.recordKeyFrame());
+    auto commit = [&] {
+        if (g.commit(dur + step))
+            dur += step;
     };
 
+    MaxFlow flow(n + 1);
     std::vector<Agnode_t *> nodes(n + 1);
     auto getNode = [&] (size_t id) {
-        render();
         if (!nodes[id])
             nodes[id] = g.allocNode();
-        render();
         return nodes[id];
     };
 
+    struct Arc final {
+        size_t index;
+        int64_t cap, shown;
+        Agedge_t *edge;
+    };
+    std::vector<Arc> arcs;
+    size_t batch = std::max<size_t>(1, (m + buildFrames - 1) / buildFrames);
     for (size_t i = 0; i < m; ++i) {
-        size_t u, v, w;
+        size_t u, v;
+        int64_t w;
         in >> u >> v >> w;
-        auto un = getNode(u);
-        auto vn = getNode(v);
-        render();
-        g.linkEdge(un, vn);
-        render();
-    }
-
-    Json json;
-    json["virtual_width"] = width;
-    json["virtual_height"] = height;
-    json["duration"] = dur;
-    json["back_color"] = { 255, 255, 255, 255 };
-    ctx.renderFrames(json["drawables"], frames, width, height);
+        if (i % batch == 0)
+            g.begin();
+        auto edge = g.linkEdge(getNode(u), getNode(v));
+        g.setLabel(edge, ("0/" + std::to_string(w)).c_str());
+        arcs.push_back({ flow.addEdge(u, v, w), w, 0, edge });
+        if (i % batch == batch - 1 || i == m - 1)
+            commit();
+    }
+
+    // Saturated arcs are red and arcs carrying flow blue; only arcs whose flow changed are touched.
+    auto show = [&] {
+        g.begin();
+        for (auto &&arc : arcs) {
+            auto f = flow.flow(arc.index);
+            if (f == arc.shown)
+                continue;
+            arc.shown = f;
+            g.setLabel(arc.edge, (std::to_string(f) + "/" + std::to_string(arc.cap)).c_str());
+            g.setColor(arc.edge, f == arc.cap ? "red" : (f ? "blue" : "black"));
+        }
+        commit();
+    };
+
+    int64_t total = 0;
+    size_t phases = 0, paths = 0;
+    while (flow.beginPhase(s, t)) {
+        ++phases;
+        while (auto f = flow.augment(s, t)) {
+            total += f;
+            ++paths;
+            if (pathsPerFrame && paths % pathsPerFrame == 0)
+                show();
+        }
+        if (!pathsPerFrame)
+            show();
+    }
+    show();
+
+    // The minimum cut: what the source still reaches against what it does not.
+    g.begin();
+    for (size_t v = 1; v <= n; ++v)
+        if (nodes[v]) {
+            bool side = flow.sourceSide(v);
+            g.setColor(nodes[v], side ? "blue" : "red");
+            g.setCluster(nodes[v], side ? "source" : "sink");
+        }
+    commit();
+
+    auto frames = ctx.collect();
+    Json header;
+    header["virtual_width"] = width;
+    header["virtual_height"] = height;
+    header["duration"] = dur;
+    header["back_color"] = { 255, 255, 255, 255 };
+    RenderOptions options;
+    options.fixedViewport = true;
     std::ofstream out("output.json");
-    out << json;
+    JsonStreamSink sink(out, header);
+    ctx.renderFrames(sink, frames, width, height, options);
+    auto stats = ctx.stats();
+    std::cout << "max flow " << total << " in " << phases << " phases, " << paths << " augmenting paths" << std::endl;
+    std::cout << g.journal().size() << " transactions" << std::endl;
+    std::cout << "layout cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.diskHits << " from disk" << std::endl;
+    if (stats.clusterHits + stats.clusterMisses)
+        std::cout << "cluster layouts: " << stats.clusterHits << " reused, " << stats.clusterMisses << " computed" << std::endl;
+    for (auto &&item : stats.engines)
+        std::cout << item.first << ": " << item.second.layouts << " layouts in " << item.second.seconds << "s" << std::endl;
     return 0;
 }
@@ -0,0 +1,384 @@
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <map>
+#include <set>
+#include <functional>
+#pragma warning(push,0)
+#include <cxxopts.hpp>
+#pragma warning(pop)
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using Json = nlohmann::json;
+
+/*
+Lossless keyframe reduction. The renderer draws a drawable at time ct by mixing the last
+keyframe before ct (prev) towards the first one at or after it (next) with next's mix mode,
+and takes the colour and discrete fields from prev. A keyframe can therefore be dropped
+whenever the segment spanning its neighbours reproduces every value it used to show.
+*/
+
+enum class MixMode {
+    lerp, smoothstep, steep
+};
+
+MixMode mixMode(const Json &frame) {
+    if (!frame.count("mix_mode"))
+        return MixMode::lerp;
+    static const std::map<std::string, MixMode> lct = { { "lerp", MixMode::lerp }, { "smoothstep", MixMode::smoothstep }, { "steep", MixMode::steep } };
+    auto iter = lct.find(frame["mix_mode"].get<std::string>());
+    if (iter == lct.cend())throw;
+    return iter->second;
+}
+
+double applyMixFunc(MixMode mode, double u) {
+    switch (mode) {
+        case MixMode::lerp:
+            return u;
+            break;
+        case MixMode::smoothstep:
+        {
+            auto f = [] (double u) {return  u * u * (3.0 - 2.0 * u); };
+            return f(f(u));
+        }
+        break;
+        case MixMode::steep:
+            return 0.0;
+            break;
+        default:throw;
+            break;
+    }
+}
+
+float timeStamp(const Json &frame) {
+    return frame["ts"].get<float>();
+}
+
+constexpr auto minDelta = 1e-5f;
+
+bool isMeta(const std::string &key) {
+    return key == "ts" || key == "mix_mode";
+}
+
+// Colours are never interpolated; array drawables carry one per element and grids a palette.
+bool isColor(const std::string &key) {
+    return key == "color" || key == "colors" || key == "palette" || key == "label_color";
+}
+
+// Points (x, y pairs, possibly many of them) and lengths in scene units. Only these are fitted within the
+// pixel tolerance; angles, scales, text sizes and counts do not map to a pixel distance and must match exactly.
+bool isPoint(const std::string &key) {
+    static const std::set<std::string> keys = { "pos", "siz", "center", "beg", "end", "ctrl", "verts", "origin", "translate" };
+    return keys.count(key) > 0;
+}
+
+bool isLength(const std::string &key) {
+    static const std::set<std::string> keys = { "radius", "rx", "ry", "width", "arrow", "arrow_offset", "beg_arrow", "end_arrow" };
+    return keys.count(key) > 0;
+}
+
+bool sameKeys(const Json &lhs, const Json &rhs) {
+    size_t cnt = 0;
+    for (auto &&item : lhs.items()) {
+        if (isMeta(item.key()))
+            continue;
+        ++cnt;
+        if (!rhs.count(item.key()))
+            return false;
+    }
+    for (auto &&item : rhs.items())
+        if (!isMeta(item.key()))
+            --cnt;
+    return cnt == 0;
+}
+
+bool sameParams(const Json &lhs, const Json &rhs) {
+    if (!sameKeys(lhs, rhs))
+        return false;
+    for (auto &&item : lhs.items())
+        if (!isMeta(item.key()) && rhs[item.key()] != item.value())
+            return false;
+    return true;
+}
+
+// Whether p equals lerp(a, c, u) within eps. Colours and discrete values are not interpolated and must match exactly.
+bool interpolates(const Json &a, const Json &c, const Json &p, double u, double eps) {
+    if (a.is_number()) {
+        if (!c.is_number() || !p.is_number())
+            return false;
+        auto v = a.get<double>() * (1.0 - u) + c.get<double>() * u;
+        return std::fabs(v - p.get<double>()) <= eps;
+    }
+    if (a.is_array()) {
+        if (!c.is_array() || !p.is_array() || a.size() != c.size() || a.size() != p.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (!interpolates(a[i], c[i], p[i], u, eps))
+                return false;
+        return true;
+    }
+    if (a.is_object()) {
+        if (!c.is_object() || !p.is_object() || !sameKeys(a, c) || !sameKeys(a, p))
+            return false;
+        for (auto &&item : a.items()) {
+            auto &&key = item.key();
+            if (isMeta(key))
+                continue;
+            if (isColor(key)) {
+                if (item.value() != c[key] || item.value() != p[key])
+                    return false;
+            }
+            else if (!interpolates(item.value(), c[key], p[key], u, eps))
+                return false;
+        }
+        return true;
+    }
+    return a == p && p == c;
+}
+
+// The keyframe with its lengths blanked out; keyframes sharing a shape only differ in values the fit may approximate.
+Json shape(const Json &frame) {
+    if (frame.is_number())
+        return nullptr;
+    if (frame.is_array()) {
+        Json res = Json::array();
+        for (auto &&item : frame)
+            res.push_back(shape(item));
+        return res;
+    }
+    if (frame.is_object()) {
+        Json res = Json::object();
+        for (auto &&item : frame.items())
+            if (!isMeta(item.key()))
+                res[item.key()] = (isPoint(item.key()) || isLength(item.key()) ? shape(item.value()) : item.value());
+        return res;
+    }
+    return frame;
+}
+
+void numbers(const Json &value, std::vector<double> &out) {
+    if (value.is_number())
+        out.push_back(value.get<double>());
+    else if (value.is_array()) {
+        for (auto &&item : value)
+            numbers(item, out);
+    }
+}
+
+// The points and lengths of a keyframe as (x, y) pairs, lengths with y = 0, so that the fit measures distances.
+void flatten(const Json &frame, std::vector<double> &out) {
+    for (auto &&item : frame.items()) {
+        if (isPoint(item.key())) {
+            numbers(item.value(), out);
+            if (out.size() % 2)
+                out.push_back(0.0);
+        }
+        else if (isLength(item.key())) {
+            std::vector<double> lengths;
+            numbers(item.value(), lengths);
+            for (auto v : lengths) {
+                out.push_back(v);
+                out.push_back(0.0);
+            }
+        }
+    }
+}
+
+struct Kept final {
+    Json frame;
+    std::vector<Json> dropped;
+};
+
+class Optimizer final {
+private:
+    double m_eps;
+    double m_tolerance;
+
+    /*
+    Lossy pass: within a run of same-shaped, non-steep keyframes, greedily replace as many
+    keyframes as possible by one lerp or smoothstep segment, as long as the original motion
+    (sampled at its keyframes and inside each of its segments) stays within m_tolerance.
+    */
+    std::vector<Json> fit(std::vector<Json> frames) const {
+        if (m_tolerance <= 0.0 || frames.size() < 3)
+            return frames;
+
+        std::vector<Json> shapes;
+        std::vector<std::vector<double>> values(frames.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            shapes.push_back(shape(frames[i]));
+            flatten(frames[i], values[i]);
+        }
+        auto joins = [&] (size_t k) {
+            return shapes[k] == shapes[k - 1] && mixMode(frames[k]) != MixMode::steep && timeStamp(frames[k]) - timeStamp(frames[k - 1]) > minDelta;
+        };
+
+        const double samples[] = { 0.25, 0.5, 0.75, 1.0 };
+        auto fits = [&] (size_t i, size_t j, MixMode mode) {
+            double ti = timeStamp(frames[i]), tj = timeStamp(frames[j]);
+            auto &&vi = values[i], &&vj = values[j];
+            for (size_t k = i + 1; k <= j; ++k) {
+                double t0 = timeStamp(frames[k - 1]), t1 = timeStamp(frames[k]);
+                auto &&v0 = values[k - 1], &&v1 = values[k];
+                auto kmode = mixMode(frames[k]);
+                for (auto u : samples) {
+                    double w = applyMixFunc(kmode, u);
+                    double f = applyMixFunc(mode, (t0 + (t1 - t0) * u - ti) / (tj - ti));
+                    for (size_t d = 0; d < vi.size(); d += 2) {
+                        double dx = (v0[d] * (1.0 - w) + v1[d] * w) - (vi[d] * (1.0 - f) + vj[d] * f);
+                        double dy = (v0[d + 1] * (1.0 - w) + v1[d + 1] * w) - (vi[d + 1] * (1.0 - f) + vj[d + 1] * f);
+                        if (std::hypot(dx, dy) > m_tolerance)
+                            return false;
+                    }
+                }
+            }
+            return true;
+        };
+
+        std::vector<Json> res;
+        res.push_back(frames[0]);
+        for (size_t i = 0; i + 1 < frames.size();) {
+            if (!joins(i + 1)) {
+                res.push_back(frames[++i]);
+                continue;
+            }
+            size_t best = i + 1;
+            MixMode bestMode = mixMode(frames[i + 1]);
+            for (size_t j = i + 2; j < frames.size() && joins(j); ++j) {
+                if (fits(i, j, MixMode::lerp))
+                    best = j, bestMode = MixMode::lerp;
+                else if (fits(i, j, MixMode::smoothstep))
+                    best = j, bestMode = MixMode::smoothstep;
+                else break;
+            }
+            Json frame = frames[best];
+            if (best > i + 1) {
+                if (bestMode == MixMode::lerp)
+                    frame.erase("mix_mode");
+                else frame["mix_mode"] = "smoothstep";
+            }
+            res.push_back(std::move(frame));
+            i = best;
+        }
+        return res;
+    }
+public:
+    size_t framesIn = 0, framesOut = 0;
+
+    // tolerance is a distance in scene units; 0 keeps the pass lossless.
+    Optimizer(double eps, double tolerance) :m_eps(eps), m_tolerance(tolerance) {}
+
+    bool removable(const Kept &a, const Kept &b, const Json &c) const {
+        float ta = timeStamp(a.frame), tb = timeStamp(b.frame), tc = timeStamp(c);
+        if (!(ta < tb && tb < tc))
+            return false;
+        // Every value along [a, c] stays put.
+        if (sameParams(a.frame, b.frame) && sameParams(b.frame, c))
+            return true;
+        // b only holds a until the steep jump to c.
+        if (sameParams(a.frame, b.frame) && mixMode(c) == MixMode::steep && tc - tb > minDelta)
+            return true;
+        // b (and whatever was merged into it) lies on the straight line from a to c.
+        if (mixMode(b.frame) == MixMode::lerp && mixMode(c) == MixMode::lerp) {
+            auto onLine = [&] (const Json &p) {
+                return interpolates(a.frame, c, p, (timeStamp(p) - ta) / static_cast<double>(tc - ta), m_eps);
+            };
+            return onLine(b.frame) && std::all_of(b.dropped.cbegin(), b.dropped.cend(), onLine);
+        }
+        return false;
+    }
+
+    Json optimize(const Json &frames) {
+        std::vector<Json> sorted(frames.cbegin(), frames.cend());
+        std::stable_sort(sorted.begin(), sorted.end(), [] (const Json &lhs, const Json &rhs) {
+            return timeStamp(lhs) < timeStamp(rhs);
+            });
+        framesIn += sorted.size();
+        sorted = fit(std::move(sorted));
+
+        std::vector<Kept> out;
+        for (auto &&frame : sorted) {
+            // A keyframe equal to its predecessor is a hold and renders the same under any mix mode,
+            // so holds (like lerp keyframes) are written without one.
+            if (mixMode(frame) == MixMode::lerp || (!out.empty() && sameParams(out.back().frame, frame)))
+                frame.erase("mix_mode");
+
+            Kept cur{ frame, {} };
+            while (out.size() >= 2 && removable(out[out.size() - 2], out.back(), cur.frame)) {
+                auto &&b = out.back();
+                cur.dropped.insert(cur.dropped.end(), std::make_move_iterator(b.dropped.begin()), std::make_move_iterator(b.dropped.end()));
+                cur.dropped.push_back(std::move(b.frame));
+                out.pop_back();
+            }
+            out.push_back(std::move(cur));
+        }
+
+        framesOut += out.size();
+        Json res = Json::array();
+        for (auto &&kept : out)
+            res.push_back(std::move(kept.frame));
+        return res;
+    }
+};
+
+int main(int argc, char **argv) {
+    cxxopts::Options options("Optimizer", "Scene keyframe optimizer");
+
+    options.add_options()("input", "input scene", cxxopts::value<std::string>())
+        ("output", "output scene", cxxopts::value<std::string>()->default_value("output.opt.json"))
+        ("epsilon", "tolerance for collinear keyframes, in scene units", cxxopts::value<double>()->default_value("0.001"))
+        ("tolerance", "max error in pixels for lossy curve fitting, 0 to disable", cxxopts::value<double>()->default_value("0"))
+        ("width", "video width the error is measured at", cxxopts::value<size_t>()->default_value("1920"))
+        ("height", "video height the error is measured at", cxxopts::value<size_t>()->default_value("1080"));
+
+    auto result = options.parse(argc, argv);
+    fs::path input = result["input"].as<std::string>();
+    fs::path output = result["output"].as<std::string>();
+    double eps = result["epsilon"].as<double>();
+    double tolerance = result["tolerance"].as<double>();
+    size_t width = result["width"].as<size_t>();
+    size_t height = result["height"].as<size_t>();
+
+    std::ifstream in(input);
+    Json json;
+    in >> json;
+    auto sizeIn = json.dump().size();
+
+    // Same fit as the renderer: one scene unit covers this many pixels, times the zoom of the camera.
+    double scale = std::min(width / json["virtual_width"].get<double>(), height / json["virtual_height"].get<double>());
+    if (json.count("camera")) {
+        // Zoom is interpolated geometrically, so it peaks at a keyframe.
+        double zoom = 0.0;
+        for (auto &&key : json["camera"])
+            zoom = std::max(zoom, key.count("zoom") ? key["zoom"].get<double>() : 1.0);
+        if (zoom > 0.0)
+            scale *= zoom;
+    }
+
+    Optimizer opt(eps, tolerance / scale);
+    std::function<void(Json &)> optimize = [&] (Json &drawables) {
+        for (auto &&drawable : drawables) {
+            if (drawable.count("frame") && drawable["frame"].is_array())
+                drawable["frame"] = opt.optimize(drawable["frame"]);
+            if (drawable.count("children"))
+                optimize(drawable["children"]);
+        }
+    };
+    optimize(json["drawables"]);
+
+    auto text = json.dump();
+    std::ofstream out(output);
+    out << text;
+
+    auto ratio = [] (size_t after, size_t before) {
+        return before ? 100.0 * (1.0 - static_cast<double>(after) / before) : 0.0;
+    };
+    std::cout << "keyframes: " << opt.framesIn << " -> " << opt.framesOut << " (-" << ratio(opt.framesOut, opt.framesIn) << "%)" << std::endl;
+    std::cout << "bytes:     " << sizeIn << " -> " << text.size() << " (-" << ratio(text.size(), sizeIn) << "%)" << std::endl;
+    return 0;
+}
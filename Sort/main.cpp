@@ -74,13 +74,21 @@ void DrawLineFrame(Json &timeline, float time, std::string mix_mode, float x1, f
 	timeline.push_back(f);
 }
 
-void DrawRectFrame(Json& timeline, float time, std::string mix_mode, float x1, float y1, float x2, float y2) {
+void DrawRectArrayFrame(Json& timeline, float time, std::string mix_mode, unsigned int t) {
 	tot++;
 	Json f;
 	f["ts"] = time;
 	f["mix_mode"] = mix_mode;
-	f["pos"] = Json::array({ x1,y1 });
-	f["siz"] = Json::array({ x2 - x1,y2 - y1 });
+	Json p = Json::array(), s = Json::array();
+	for (int i = 0; i < n; i++) {
+		float x = margin_hor + (pos[i][t] + 0.5f) * box_width;
+		float y = win_height - margin_ver;
+		float h = base_height * (1.f * val[i] / max_value);
+		p.push_back(x - str_width / 2); p.push_back(y - h);
+		s.push_back(str_width); s.push_back(h);
+	}
+	f["pos"] = p;
+	f["siz"] = s;
 	timeline.push_back(f);
 }
 
@@ -121,45 +129,18 @@ void DrawBottomLine(Json& ele_list) {
 void DrawStrip(Json& ele_list) {
 	unsigned int cnt = pos[0].size();
 	total_time = cnt * frame_dur + 1.f;
-	std::vector<Json> timeline(n);
-	std::vector<Json> ele(n);
-	std::vector<int> last(n, -1);
-	for (unsigned int t = 0; t < cnt; t++) {
-		for (int i = 0; i < n; i++) {
-			if (t > 0 && pos[i][t - 1] != pos[i][t]) {
-				int p = pos[i][t - 1];
-				float x, y;
-				x = margin_hor + (p + 0.5f) * box_width;
-				y = win_height - margin_ver;
-				DrawRectFrame(timeline[i], (t - 1) * frame_dur, "smoothstep", x - str_width / 2, y - base_height * (1.f * val[i] / max_value), x + str_width / 2, y);
-				p = pos[i][t];
-				x = margin_hor + (p + 0.5f) * box_width;
-				y = win_height - margin_ver;
-				DrawRectFrame(timeline[i], t * frame_dur - 0.000001f, "smoothstep", x - str_width / 2, y - base_height * (1.f * val[i] / max_value), x + str_width / 2, y);
-			} else if (t == 0) {
-				int p = pos[i][t];
-				float x = margin_hor + (p + 0.5f) * box_width;
-				float y = win_height - margin_ver;
-	DrawBottomLine(ele_list);
-				DrawRectFrame(timeline[i], t * frame_dur, "smoothstep", x - str_width / 2, y - base_height * (1.f * val[i] / max_value), x + str_width / 2, y);
-			}
-		}
-	}
-	for (int i = 0; i < n; i++) {
-		int p = pos[i][cnt - 1];
-		float x = margin_hor + (p + 0.5f) * box_width;
-		float y = win_height - margin_ver;
-		DrawRectFrame(timeline[i], cnt * frame_dur + 1.f, "smoothstep", x - str_width / 2, y - base_height * (1.f * val[i] / max_value), x + str_width / 2, y);
-	}
-	for (int i = 0; i < n; i++) {
-		ele[i]["type"] = "Rect";
-		ele[i]["color"] = Json::array({ 59,217,130 });
-		ele[i]["width"] = 1.f;
-		ele[i]["fill"] = true;
-		ele[i]["frame"] = timeline[i];
-		ele_list.push_back(ele[i]);
-	DrawBottomLine(ele_list);
-	}
+	/* All bars in one RectArray, one keyframe per step; bars that did not move stay put */
+	Json timeline;
+	for (unsigned int t = 0; t < cnt; t++)
+		DrawRectArrayFrame(timeline, t * frame_dur, "smoothstep", t);
+	DrawRectArrayFrame(timeline, cnt * frame_dur + 1.f, "smoothstep", cnt - 1);
+	Json ele;
+	ele["type"] = "RectArray";
+	ele["color"] = Json::array({ 59,217,130 });
+	ele["width"] = 1.f;
+	ele["fill"] = true;
+	ele["frame"] = timeline;
+	ele_list.push_back(ele);
 }
 
 void DrawArrow(Json& ele_list) {
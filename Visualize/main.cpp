@@ -6,6 +6,7 @@
 #include <nanovg_gl.h>
 #include <functional>
 #include <thread>
+#include <future>
 #include <memory>
 #include <chrono>
 #include <glm/glm.hpp>
@@ -15,6 +16,9 @@
 #include <filesystem>
 #include <algorithm>
 #include <cmath>
+#include <tuple>
+#include <limits>
+#include <cstring>
 #pragma warning(push,0)
 #include <cxxopts.hpp>
 #pragma warning(pop)
@@ -43,6 +47,35 @@ glm::vec2 parseVec2(const Json &vec) {
     return { parseFloat(vec[0]), parseFloat(vec[1]) };
 }
 
+// Axis-aligned box in scene units; a default box is empty.
+struct Bounds final {
+    glm::vec2 lo = { std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity() };
+    glm::vec2 hi = { -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity() };
+
+    static Bounds everywhere() {
+        Bounds res;
+        std::swap(res.lo, res.hi);
+        return res;
+    }
+    void extend(glm::vec2 p) {
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    void unite(const Bounds &rhs) {
+        lo = glm::min(lo, rhs.lo);
+        hi = glm::max(hi, rhs.hi);
+    }
+    Bounds grow(float d) const {
+        Bounds res = *this;
+        res.lo -= glm::vec2{ d, d };
+        res.hi += glm::vec2{ d, d };
+        return res;
+    }
+    bool intersects(const Bounds &rhs) const {
+        return lo.x <= rhs.hi.x && rhs.lo.x <= hi.x && lo.y <= rhs.hi.y && rhs.lo.y <= hi.y;
+    }
+};
+
 class Drawable {
 private:
     NVGcolor m_col;
@@ -61,11 +94,15 @@ protected:
     }
 
     void setParams(NVGcontext *ctx) const {
+        setParams(ctx, m_useKcol ? m_kcol : m_col);
+    }
+
+    void setParams(NVGcontext *ctx, const NVGcolor &col) const {
         if (m_fill) {
-            nvgFillColor(ctx, m_useKcol ? m_kcol : m_col);
+            nvgFillColor(ctx, col);
         }
         else {
-            nvgStrokeColor(ctx, m_useKcol ? m_kcol : m_col);
+            nvgStrokeColor(ctx, col);
             nvgStrokeWidth(ctx, m_width);
         }
     }
@@ -77,8 +114,17 @@ protected:
             nvgStroke(ctx);
     }
 
+    bool filled() const {
+        return m_fill;
+    }
+
+    // Grows the box of a path by half the stroke and one pixel of antialiasing.
+    Bounds pad(const Bounds &box) const {
+        return box.grow(m_fill ? 1.0f : m_width * 0.5f + 1.0f);
+    }
+
 public:
-    explicit Drawable(const Json &args) :m_col(parseColor(args["color"])), m_width(1.0f), m_fill(args.count("fill") ? args["fill"].get<bool>() : false), m_useKcol(false), m_layer(0) {
+    explicit Drawable(const Json &args) :m_col(args.count("color") ? parseColor(args["color"]) : nvgRGB(0, 0, 0)), m_width(1.0f), m_fill(args.count("fill") ? args["fill"].get<bool>() : false), m_useKcol(false), m_layer(0) {
         if (!m_fill && args.count("width"))
             m_width = parseFloat(args["width"]);
         if (args.count("layer"))
@@ -87,6 +133,31 @@ public:
     virtual std::shared_ptr<Drawable> mix(float u, const std::shared_ptr<Drawable> &rhs) const = 0;
     virtual void loadParams(const Json &args) = 0;
     virtual void draw(NVGcontext *ctx, float w, float h) const = 0;
+    // Called on the drawable sampled at time ct before it is drawn.
+    virtual void update(float ct) {}
+    // Contains everything the keyframe draws.
+    virtual Bounds bounds() const {
+        return Bounds::everywhere();
+    }
+    // Contains everything drawn while mixing this keyframe towards rhs. Mixing interpolates linearly
+    // between the parameters of most drawables, so the result stays within the union of their bounds.
+    virtual Bounds mixedBounds(const Drawable &rhs) const {
+        Bounds res = bounds();
+        res.unite(rhs.bounds());
+        return res;
+    }
+    // Whether the keyframe draws nothing whatever its colour, e.g. a shape of zero size.
+    virtual bool empty() const {
+        return false;
+    }
+    // Whether no mix of this keyframe towards rhs draws anything.
+    virtual bool emptyMixedWith(const Drawable &rhs) const {
+        return empty() && rhs.empty();
+    }
+    // Whether the keyframe draws nothing whatever its shape. Mixing keeps the colour of the earlier keyframe.
+    virtual bool transparent() const {
+        return (m_useKcol ? m_kcol : m_col).a <= 0.0f;
+    }
     virtual ~Drawable() = 0 {}
     bool  operator<(const Drawable &rhs) const {
         return m_layer < rhs.m_layer;
@@ -124,6 +195,15 @@ public:
         nvgRect(ctx, m_pos.x, m_pos.y, m_siz.x, m_siz.y);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        Bounds res;
+        res.extend(m_pos);
+        res.extend(m_pos + m_siz);
+        return pad(res);
+    }
+    bool empty() const override {
+        return m_siz.x == 0.0f && m_siz.y == 0.0f;
+    }
 };
 
 void drawLine(NVGcontext *ctx, glm::vec2 beg, glm::vec2 end) {
@@ -179,6 +259,15 @@ public:
         drawArrow(ctx, m_end, -dir, m_endArrow);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        Bounds res;
+        res.extend(m_beg);
+        res.extend(m_end);
+        return pad(res.grow(std::max({ m_begArrow, m_endArrow, 1.0f })));
+    }
+    bool empty() const override {
+        return m_beg == m_end && m_begArrow <= 0.0f && m_endArrow <= 0.0f;
+    }
 };
 
 class Curve final :public Drawable {
@@ -216,6 +305,14 @@ public:
         drawArrow(ctx, m_end, glm::normalize(m_end - ct2), m_endArrow);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        // The control points span the convex hull of the curve.
+        Bounds res;
+        res.extend(m_beg);
+        res.extend(m_end);
+        res.extend(m_ctrl);
+        return pad(res.grow(std::max({ m_begArrow, m_endArrow, 1.0f })));
+    }
 };
 
 class Text final :public Drawable {
@@ -223,6 +320,23 @@ private:
     glm::vec2 m_center;
     float m_siz;
     std::vector< std::string> m_text;
+
+    // No glyph is wider than the font size; UTF-8 bytes overcount characters.
+    size_t columns() const {
+        size_t len = 0;
+        for (auto &&line : m_text)
+            len = std::max(len, line.size());
+        return len;
+    }
+    Bounds around(Bounds centers, float siz, size_t len, size_t lines) const {
+        glm::vec2 half = { siz * len * 0.5f, siz * (lines * 0.5f + 1.0f) };
+        centers.lo -= half;
+        centers.hi += half;
+        return pad(centers);
+    }
+    bool blank() const {
+        return std::all_of(m_text.cbegin(), m_text.cend(), [] (const std::string &line) {return line.empty(); });
+    }
 public:
     explicit Text(const Json &args) :Drawable(args) {}
     void loadParams(const Json &args) override {
@@ -255,6 +369,27 @@ public:
             nvgText(ctx, m_center.x, basey + m_siz * i, m_text[i].c_str(), nullptr);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        Bounds res;
+        res.extend(m_center);
+        return around(res, m_siz, columns(), m_text.size());
+    }
+    // The size is interpolated but the text switches halfway, so either text may be drawn at the larger size.
+    Bounds mixedBounds(const Drawable &rhs) const override {
+        auto &&crhs = dynamic_cast<const Text &>(rhs);
+        Bounds res;
+        res.extend(m_center);
+        res.extend(crhs.m_center);
+        return around(res, std::max(m_siz, crhs.m_siz), std::max(columns(), crhs.columns()), std::max(m_text.size(), crhs.m_text.size()));
+    }
+    bool empty() const override {
+        return m_siz == 0.0f || blank();
+    }
+    // A mix of a zero-sized text and a blank one draws the first text at a size in between.
+    bool emptyMixedWith(const Drawable &rhs) const override {
+        auto &&crhs = dynamic_cast<const Text &>(rhs);
+        return (m_siz == 0.0f && crhs.m_siz == 0.0f) || (blank() && crhs.blank());
+    }
 };
 
 class Circle final :public Drawable {
@@ -282,6 +417,14 @@ public:
         nvgCircle(ctx, m_center.x, m_center.y, m_radius);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        Bounds res;
+        res.extend(m_center);
+        return pad(res.grow(std::fabs(m_radius)));
+    }
+    bool empty() const override {
+        return m_radius == 0.0f;
+    }
 };
 
 class Ellipse final :public Drawable {
@@ -311,6 +454,16 @@ public:
         nvgEllipse(ctx, m_center.x, m_center.y, m_rx, m_ry);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        glm::vec2 half = { std::fabs(m_rx), std::fabs(m_ry) };
+        Bounds res;
+        res.extend(m_center - half);
+        res.extend(m_center + half);
+        return pad(res);
+    }
+    bool empty() const override {
+        return m_rx == 0.0f && m_ry == 0.0f;
+    }
 };
 
 
@@ -443,6 +596,12 @@ public:
             nvgLineTo(ctx, m_verts[i].x, m_verts[i].y);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        Bounds res;
+        for (auto &&p : m_verts)
+            res.extend(p);
+        return pad(res);
+    }
 };
 
 class Polygon final :public Drawable {
@@ -479,6 +638,12 @@ public:
             nvgLineTo(ctx, m_verts[i].x, m_verts[i].y);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        Bounds res;
+        for (auto &&p : m_verts)
+            res.extend(p);
+        return pad(res);
+    }
 };
 
 class Bezierline final :public Drawable {
@@ -518,36 +683,356 @@ public:
             nvgLineTo(ctx, m_verts[j].x, m_verts[j].y);
         commit(ctx);
     }
+    Bounds bounds() const override {
+        Bounds res;
+        for (auto &&p : m_verts)
+            res.extend(p);
+        return pad(res);
+    }
 };
 
 
-#undef MIX
+/*
+Array drawables hold many shapes of one kind as flat float arrays, so that mixing a keyframe is
+one loop over contiguous memory and drawing takes one path per colour. A keyframe may give
+"colors", one per element; like "color", they are taken from the earlier keyframe. Elements
+missing from the later keyframe keep the values of the earlier one.
+*/
+std::vector<float> parseFloats(const Json &arr) {
+    std::vector<float> res;
+    res.reserve(arr.size());
+    for (auto &&v : arr)
+        res.push_back(parseFloat(v));
+    return res;
+}
+
+void mixFloats(std::vector<float> &res, const std::vector<float> &rhs, float u) {
+    size_t n = std::min(res.size(), rhs.size());
+    float *a = res.data();
+    const float *b = rhs.data();
+    for (size_t i = 0; i < n; ++i)
+        a[i] += (b[i] - a[i]) * u;
+}
+
+// Elements grouped by colour, in element order within each group.
+struct ColorGroup final {
+    NVGcolor col;
+    std::vector<uint32_t> items;
+};
+using ColorGroups = std::shared_ptr<const std::vector<ColorGroup>>;
+
+ColorGroups parseColorGroups(const Json &args, size_t count) {
+    auto groups = std::make_shared<std::vector<ColorGroup>>();
+    if (!args.count("colors"))
+        return groups;
+    auto &&cols = args["colors"];
+    assert(cols.size() == count);
+    std::map<std::tuple<float, float, float, float>, size_t> index;
+    for (size_t i = 0; i < count; ++i) {
+        auto col = parseColor(cols[i]);
+        auto key = std::make_tuple(col.r, col.g, col.b, col.a);
+        auto iter = index.find(key);
+        if (iter == index.cend()) {
+            iter = index.emplace(key, groups->size()).first;
+            groups->push_back({ col, {} });
+        }
+        (*groups)[iter->second].items.push_back(static_cast<uint32_t>(i));
+    }
+    return groups;
+}
+
+class RectArray final :public Drawable {
+private:
+    std::vector<float> m_pos, m_siz;
+    ColorGroups m_groups;
 
-class DrawableFactory final {
 public:
-    using Generator = std::function<std::shared_ptr<Drawable>(const Json &args)>;
-    DrawableFactory() {
-#define ITEM(name) m_generators[#name] = [] (const Json &args) {   return std::make_shared<name>(args);  }
-        ITEM(Rect);
-        ITEM(Curve);
-        ITEM(Line);
-        ITEM(Text);
-        ITEM(Circle);
-        ITEM(Ray);
-        ITEM(HalfPlane);
-        ITEM(Ellipse);
-        ITEM(Polyline);
-        ITEM(Polygon);
-        ITEM(Bezierline);
-#undef ITEM
+    explicit RectArray(const Json &args) :Drawable(args) {}
+    void loadParams(const Json &args) override {
+        m_pos = parseFloats(args["pos"]);
+        m_siz = parseFloats(args["siz"]);
+        assert(m_pos.size() == m_siz.size() && m_pos.size() % 2 == 0);
+        m_groups = parseColorGroups(args, m_pos.size() / 2);
+        tryUseKcol(args);
     }
-    Generator get(const std::string &type) const {
-        auto iter = m_generators.find(type);
-        if (iter == m_generators.cend())throw;
-        return iter->second;
+    std::shared_ptr<Drawable> mix(float u, const std::shared_ptr<Drawable> &rhs) const override {
+        auto crhs = std::dynamic_pointer_cast<RectArray>(rhs);
+        assert(crhs);
+        auto res = std::make_shared<RectArray>(*this);
+        mixFloats(res->m_pos, crhs->m_pos, u);
+        mixFloats(res->m_siz, crhs->m_siz, u);
+        return res;
+    }
+    void draw(NVGcontext *ctx, float w, float h) const override {
+        auto rect = [&] (size_t i) {
+            nvgRect(ctx, m_pos[i * 2], m_pos[i * 2 + 1], m_siz[i * 2], m_siz[i * 2 + 1]);
+        };
+        if (m_groups->empty()) {
+            nvgBeginPath(ctx);
+            setParams(ctx);
+            for (size_t i = 0; i < m_pos.size() / 2; ++i)
+                rect(i);
+            commit(ctx);
+        }
+        for (auto &&group : *m_groups) {
+            nvgBeginPath(ctx);
+            setParams(ctx, group.col);
+            for (auto i : group.items)
+                rect(i);
+            commit(ctx);
+        }
     }
+    Bounds bounds() const override {
+        Bounds res;
+        for (size_t i = 0; i + 1 < m_pos.size(); i += 2) {
+            res.extend({ m_pos[i], m_pos[i + 1] });
+            res.extend({ m_pos[i] + m_siz[i], m_pos[i + 1] + m_siz[i + 1] });
+        }
+        return pad(res);
+    }
+    bool empty() const override {
+        for (size_t i = 0; i < m_siz.size(); ++i)
+            if (m_siz[i] != 0.0f)
+                return false;
+        return true;
+    }
+    bool transparent() const override {
+        if (m_groups->empty())
+            return Drawable::transparent();
+        return std::all_of(m_groups->cbegin(), m_groups->cend(), [] (const ColorGroup &group) {return group.col.a <= 0.0f; });
+    }
+};
+
+class CircleArray final :public Drawable {
 private:
-    std::map <std::string, Generator> m_generators;
+    std::vector<float> m_center, m_radius;
+    ColorGroups m_groups;
+
+public:
+    explicit CircleArray(const Json &args) :Drawable(args) {}
+    void loadParams(const Json &args) override {
+        m_center = parseFloats(args["center"]);
+        m_radius = parseFloats(args["radius"]);
+        assert(m_center.size() == m_radius.size() * 2);
+        m_groups = parseColorGroups(args, m_radius.size());
+        tryUseKcol(args);
+    }
+    std::shared_ptr<Drawable> mix(float u, const std::shared_ptr<Drawable> &rhs) const override {
+        auto crhs = std::dynamic_pointer_cast<CircleArray>(rhs);
+        assert(crhs);
+        auto res = std::make_shared<CircleArray>(*this);
+        mixFloats(res->m_center, crhs->m_center, u);
+        mixFloats(res->m_radius, crhs->m_radius, u);
+        return res;
+    }
+    void draw(NVGcontext *ctx, float w, float h) const override {
+        auto circle = [&] (size_t i) {
+            nvgCircle(ctx, m_center[i * 2], m_center[i * 2 + 1], m_radius[i]);
+        };
+        if (m_groups->empty()) {
+            nvgBeginPath(ctx);
+            setParams(ctx);
+            for (size_t i = 0; i < m_radius.size(); ++i)
+                circle(i);
+            commit(ctx);
+        }
+        for (auto &&group : *m_groups) {
+            nvgBeginPath(ctx);
+            setParams(ctx, group.col);
+            for (auto i : group.items)
+                circle(i);
+            commit(ctx);
+        }
+    }
+    Bounds bounds() const override {
+        Bounds res;
+        for (size_t i = 0; i < m_radius.size(); ++i) {
+            glm::vec2 half = { std::fabs(m_radius[i]), std::fabs(m_radius[i]) };
+            res.extend(glm::vec2{ m_center[i * 2], m_center[i * 2 + 1] } - half);
+            res.extend(glm::vec2{ m_center[i * 2], m_center[i * 2 + 1] } + half);
+        }
+        return pad(res);
+    }
+    bool empty() const override {
+        return std::all_of(m_radius.cbegin(), m_radius.cend(), [] (float r) {return r == 0.0f; });
+    }
+    bool transparent() const override {
+        if (m_groups->empty())
+            return Drawable::transparent();
+        return std::all_of(m_groups->cbegin(), m_groups->cend(), [] (const ColorGroup &group) {return group.col.a <= 0.0f; });
+    }
+};
+
+/*
+A Grid draws rows x cols cells as one image. "cells" is a string with one character per cell in
+row-major order; character c picks colour c - '0' of "palette", and characters naming no colour
+(such as '.') leave their cells transparent. The palette may be given once on the drawable instead of in every keyframe.
+Optional "labels" (one string per cell, "" for none) are drawn centred in their cells at
+"label_size" in "label_color". "pos" and "siz" span the whole grid and are interpolated;
+like colours, cells and labels are taken from the earlier keyframe. Unless the grid is filled,
+cell borders are stroked in the drawable colour.
+*/
+struct GridImage final {
+    NVGcontext *ctx = nullptr;
+    int handle = 0, rows = 0, cols = 0;
+    // Keyframe buffer the texture last showed, and a copy of the texture.
+    std::shared_ptr<const std::vector<uint8_t>> source;
+    std::vector<uint8_t> pixels;
+
+    ~GridImage() {
+        if (handle)
+            nvgDeleteImage(ctx, handle);
+    }
+    // Uploads only the band of rows from the first to the last one that differs from what the texture shows.
+    void show(NVGcontext *context, int r, int c, const std::shared_ptr<const std::vector<uint8_t>> &buffer) {
+        if (source == buffer)
+            return;
+        if (handle && (ctx != context || rows != r || cols != c)) {
+            nvgDeleteImage(ctx, handle);
+            handle = 0;
+        }
+        source = buffer;
+        if (!handle) {
+            ctx = context;
+            rows = r;
+            cols = c;
+            pixels = *buffer;
+            handle = nvgCreateImageRGBA(ctx, cols, rows, NVG_IMAGE_NEAREST, pixels.data());
+            return;
+        }
+        size_t stride = static_cast<size_t>(cols) * 4;
+        int lo = rows, hi = 0;
+        for (int y = 0; y < rows; ++y)
+            if (memcmp(pixels.data() + y * stride, buffer->data() + y * stride, stride)) {
+                lo = std::min(lo, y);
+                hi = y + 1;
+            }
+        if (lo >= hi)
+            return;
+        std::copy(buffer->cbegin() + lo * stride, buffer->cbegin() + hi * stride, pixels.begin() + lo * stride);
+        // nvgUpdateImage would send every row. The GL backends' renderUpdateTexture takes the whole image and
+        // uploads only the given sub-rectangle of it (through the unpack row length and skips, or an offset pointer on GLES2).
+        auto params = nvgInternalParams(ctx);
+        params->renderUpdateTexture(params->userPtr, handle, 0, lo, cols, hi - lo, pixels.data());
+    }
+};
+
+class Grid final :public Drawable {
+private:
+    glm::vec2 m_pos, m_siz;
+    int m_rows, m_cols;
+    std::vector<NVGcolor> m_palette;
+    std::shared_ptr<const std::vector<uint8_t>> m_pixels;
+    std::shared_ptr<const std::vector<std::string>> m_labels;
+    float m_labelSize;
+    NVGcolor m_labelCol;
+    std::shared_ptr<GridImage> m_image;
+
+    static std::vector<NVGcolor> parsePalette(const Json &arr) {
+        std::vector<NVGcolor> res;
+        for (auto &&col : arr)
+            res.push_back(parseColor(col));
+        return res;
+    }
+
+public:
+    explicit Grid(const Json &args) :Drawable(args) {
+        if (args.count("palette"))
+            m_palette = parsePalette(args["palette"]);
+    }
+    // Keyframes of one grid share the texture.
+    void setImage(const std::shared_ptr<GridImage> &image) {
+        m_image = image;
+    }
+    void loadParams(const Json &args) override {
+        m_pos = parseVec2(args["pos"]);
+        m_siz = parseVec2(args["siz"]);
+        m_rows = args["rows"].get<int>();
+        m_cols = args["cols"].get<int>();
+        if (args.count("palette"))
+            m_palette = parsePalette(args["palette"]);
+        auto &&cells = args["cells"].get_ref<const std::string &>();
+        assert(cells.size() == static_cast<size_t>(m_rows) * m_cols);
+        auto pixels = std::make_shared<std::vector<uint8_t>>(cells.size() * 4, 0);
+        auto byte = [] (float v) {return static_cast<uint8_t>(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f); };
+        for (size_t i = 0; i < cells.size(); ++i) {
+            size_t v = static_cast<unsigned char>(cells[i] - '0');
+            if (v >= m_palette.size())
+                continue;
+            auto &&col = m_palette[v];
+            uint8_t *px = pixels->data() + i * 4;
+            px[0] = byte(col.r);
+            px[1] = byte(col.g);
+            px[2] = byte(col.b);
+            px[3] = byte(col.a);
+        }
+        m_pixels = pixels;
+        if (args.count("labels")) {
+            auto labels = std::make_shared<std::vector<std::string>>();
+            for (auto &&label : args["labels"])
+                labels->push_back(label.get<std::string>());
+            assert(labels->size() == cells.size());
+            m_labels = labels;
+        }
+        m_labelSize = (args.count("label_size") ? parseFloat(args["label_size"]) : std::min(m_siz.x / m_cols, m_siz.y / m_rows) * 0.5f);
+        m_labelCol = (args.count("label_color") ? parseColor(args["label_color"]) : nvgRGB(255, 255, 255));
+        tryUseKcol(args);
+    }
+    std::shared_ptr<Drawable> mix(float u, const std::shared_ptr<Drawable> &rhs) const override {
+        auto crhs = std::dynamic_pointer_cast<Grid>(rhs);
+        assert(crhs);
+        auto res = std::make_shared<Grid>(*this);
+        MIX(m_pos);
+        MIX(m_siz);
+        MIX(m_labelSize);
+        return res;
+    }
+    void draw(NVGcontext *ctx, float w, float h) const override {
+        if (!m_rows || !m_cols)
+            return;
+        m_image->show(ctx, m_rows, m_cols, m_pixels);
+        nvgBeginPath(ctx);
+        nvgRect(ctx, m_pos.x, m_pos.y, m_siz.x, m_siz.y);
+        nvgFillPaint(ctx, nvgImagePattern(ctx, m_pos.x, m_pos.y, m_siz.x, m_siz.y, 0.0f, m_image->handle, 1.0f));
+        nvgFill(ctx);
+
+        glm::vec2 cell = { m_siz.x / m_cols, m_siz.y / m_rows };
+        if (!filled()) {
+            nvgBeginPath(ctx);
+            setParams(ctx);
+            for (int y = 0; y <= m_rows; ++y)
+                drawLine(ctx, m_pos + glm::vec2{ 0.0f, cell.y * y }, m_pos + glm::vec2{ m_siz.x, cell.y * y });
+            for (int x = 0; x <= m_cols; ++x)
+                drawLine(ctx, m_pos + glm::vec2{ cell.x * x, 0.0f }, m_pos + glm::vec2{ cell.x * x, m_siz.y });
+            commit(ctx);
+        }
+
+        if (!m_labels)
+            return;
+        nvgFillColor(ctx, m_labelCol);
+        nvgTextAlign(ctx, NVG_ALIGN_CENTER | NVG_ALIGN_MIDDLE);
+        nvgFontFace(ctx, "font");
+        nvgFontSize(ctx, m_labelSize);
+        for (int y = 0; y < m_rows; ++y)
+            for (int x = 0; x < m_cols; ++x) {
+                auto &&label = (*m_labels)[static_cast<size_t>(y) * m_cols + x];
+                if (!label.empty())
+                    nvgText(ctx, m_pos.x + cell.x * (x + 0.5f), m_pos.y + cell.y * (y + 0.5f), label.c_str(), nullptr);
+            }
+    }
+    Bounds bounds() const override {
+        Bounds res;
+        res.extend(m_pos);
+        res.extend(m_pos + m_siz);
+        return pad(res);
+    }
+    bool empty() const override {
+        return !m_rows || !m_cols;
+    }
+    // Cells have colours of their own.
+    bool transparent() const override {
+        return false;
+    }
 };
 
 enum class MixMode {
@@ -584,6 +1069,10 @@ struct KeyFrame final {
     float timeStamp;
     MixMode mixMode;
     std::shared_ptr<Drawable> drawable;
+    // Contains everything drawn between the previous keyframe and this one.
+    Bounds span;
+    // Provably nothing is drawn between the previous keyframe and this one.
+    bool hidden = false;
     bool operator<(const KeyFrame &rhs) const {
         return timeStamp < rhs.timeStamp;
     }
@@ -593,6 +1082,334 @@ struct DrawableAnimation final {
     std::vector<KeyFrame> frames;
 };
 
+// Appends what ani draws at time ct, unless it is hidden then or lies outside view. Drawables
+// outside view are skipped before they are mixed.
+void sampleAnimation(const DrawableAnimation &ani, float ct, const Bounds &view, std::vector<std::shared_ptr<Drawable>> &toDraw) {
+    auto &&frames = ani.frames;
+    auto iter = std::lower_bound(frames.cbegin(), frames.cend(), KeyFrame{ ct, MixMode::lerp, nullptr });
+    if (iter == frames.cbegin() || iter == frames.cend() || iter->hidden)
+        return;
+    auto prev = iter - 1;
+    if (!iter->span.intersects(view))
+        return;
+    auto delta = iter->timeStamp - prev->timeStamp;
+    if (delta > 1e-5f) {
+        auto u = (ct - prev->timeStamp) / delta;
+        toDraw.push_back(mix(prev->drawable, iter->drawable, applyMixFunc(iter->mixMode, u)));
+    }
+    // update() changes the sampled drawable, so it gets a copy rather than the loaded keyframe.
+    else toDraw.push_back(mix(iter->drawable, iter->drawable, 0.0f));
+    toDraw.back()->update(ct);
+}
+
+// Drawables of one layer keep the order of the scene file.
+void sortByLayer(std::vector<std::shared_ptr<Drawable>> &toDraw) {
+    std::stable_sort(toDraw.begin(), toDraw.end(), [] (const std::shared_ptr<Drawable> &lhs, const std::shared_ptr<Drawable> &rhs) {
+        return *lhs < *rhs;
+        });
+}
+
+// Samples every animation drawn at time ct within view, in layer order.
+std::vector<std::shared_ptr<Drawable>> sampleAnimations(const std::vector<DrawableAnimation> &anis, float ct, const Bounds &view) {
+    std::vector<std::shared_ptr<Drawable>> toDraw;
+    for (auto &&ani : anis)
+        sampleAnimation(ani, ct, view, toDraw);
+    sortByLayer(toDraw);
+    return toDraw;
+}
+
+/*
+Generators often hide a drawable (zero size, parked off-canvas, or transparent) instead of ending
+it. Such spans are marked on their closing keyframe at load time, along with the box they draw in,
+and the schedule only hands the render loop animations with a visible span at the current time.
+*/
+void markHidden(DrawableAnimation &ani, const Bounds &canvas) {
+    auto &&frames = ani.frames;
+    for (size_t k = 1; k < frames.size(); ++k) {
+        auto &&prev = frames[k - 1], &&cur = frames[k];
+        cur.span = prev.drawable->mixedBounds(*cur.drawable);
+        cur.hidden = prev.drawable->transparent() || prev.drawable->emptyMixedWith(*cur.drawable) || !cur.span.intersects(canvas);
+    }
+}
+
+class Schedule final {
+private:
+    // Animation ani may be drawn at times in (begin, end].
+    struct Span final {
+        float begin, end;
+        size_t ani;
+    };
+    std::vector<Span> m_spans;
+    size_t m_next = 0;
+    std::vector<Span> m_active;
+    std::vector<size_t> m_current;
+
+public:
+    explicit Schedule(const std::vector<DrawableAnimation> &anis) {
+        for (size_t i = 0; i < anis.size(); ++i) {
+            auto &&frames = anis[i].frames;
+            for (size_t k = 1; k < frames.size(); ++k) {
+                if (frames[k].hidden)
+                    continue;
+                if (!m_spans.empty() && m_spans.back().ani == i && m_spans.back().end == frames[k - 1].timeStamp)
+                    m_spans.back().end = frames[k].timeStamp;
+                else m_spans.push_back(Span{ frames[k - 1].timeStamp, frames[k].timeStamp, i });
+            }
+        }
+        std::stable_sort(m_spans.begin(), m_spans.end(), [] (const Span &lhs, const Span &rhs) {
+            return lhs.begin < rhs.begin;
+            });
+    }
+    // Animations that may be drawn at time ct, in scene order. ct must not decrease between calls.
+    const std::vector<size_t> &advance(float ct) {
+        while (m_next < m_spans.size() && m_spans[m_next].begin < ct)
+            m_active.push_back(m_spans[m_next++]);
+        m_active.erase(std::remove_if(m_active.begin(), m_active.end(), [ct] (const Span &span) {return span.end < ct; }), m_active.end());
+        m_current.clear();
+        for (auto &&span : m_active)
+            m_current.push_back(span.ani);
+        std::sort(m_current.begin(), m_current.end());
+        return m_current;
+    }
+};
+
+/*
+Children keep their own keyframes in the local coordinates of the group, whose keyframes only
+hold a transform: "translate", "scale" (one factor or [sx, sy]) and "rotate" (radians) around
+"origin". Moving a whole row of drawables then costs one keyframe on the group.
+*/
+class Group final :public Drawable {
+private:
+    glm::vec2 m_translate, m_scale, m_origin;
+    float m_rotate;
+    std::shared_ptr<const std::vector<DrawableAnimation>> m_children;
+    Bounds m_childBounds;
+    std::vector<std::shared_ptr<Drawable>> m_visible;
+
+public:
+    explicit Group(const Json &args) :Drawable(args) {}
+    // childBounds holds every keyframe of the children, in local coordinates.
+    void setChildren(const std::shared_ptr<const std::vector<DrawableAnimation>> &children, const Bounds &childBounds) {
+        m_children = children;
+        m_childBounds = childBounds;
+    }
+    void loadParams(const Json &args) override {
+        m_translate = (args.count("translate") ? parseVec2(args["translate"]) : glm::vec2{ 0.0f, 0.0f });
+        m_origin = (args.count("origin") ? parseVec2(args["origin"]) : glm::vec2{ 0.0f, 0.0f });
+        m_rotate = (args.count("rotate") ? parseFloat(args["rotate"]) : 0.0f);
+        if (!args.count("scale"))
+            m_scale = { 1.0f, 1.0f };
+        else if (args["scale"].is_array())
+            m_scale = parseVec2(args["scale"]);
+        else m_scale = glm::vec2{ 1.0f, 1.0f } * parseFloat(args["scale"]);
+    }
+    std::shared_ptr<Drawable> mix(float u, const std::shared_ptr<Drawable> &rhs) const override {
+        auto crhs = std::dynamic_pointer_cast<Group>(rhs);
+        assert(crhs);
+        auto res = std::make_shared<Group>(*this);
+        MIX(m_translate);
+        MIX(m_scale);
+        MIX(m_origin);
+        MIX(m_rotate);
+        return res;
+    }
+    void update(float ct) override {
+        m_visible.clear();
+        if (m_children)
+            m_visible = sampleAnimations(*m_children, ct, Bounds::everywhere());
+    }
+    void draw(NVGcontext *ctx, float w, float h) const override {
+        if (m_visible.empty())
+            return;
+        // p' = translate + origin + R * S * (p - origin)
+        float c = std::cos(m_rotate), s = std::sin(m_rotate);
+        glm::vec2 ex = glm::vec2{ c, s } * m_scale.x, ey = glm::vec2{ -s, c } * m_scale.y;
+        glm::vec2 t = m_translate + m_origin - ex * m_origin.x - ey * m_origin.y;
+        nvgSave(ctx);
+        nvgTransform(ctx, ex.x, ex.y, ey.x, ey.y, t.x, t.y);
+        for (auto &&item : m_visible)
+            item->draw(ctx, w, h);
+        nvgRestore(ctx);
+    }
+    Bounds bounds() const override {
+        // Points only move linearly between two keyframes without rotation or a pivot.
+        if (m_rotate != 0.0f || m_origin != glm::vec2{ 0.0f, 0.0f })
+            return Bounds::everywhere();
+        Bounds res;
+        if (m_childBounds.lo.x <= m_childBounds.hi.x) {
+            res.extend(m_translate + m_scale * m_childBounds.lo);
+            res.extend(m_translate + m_scale * m_childBounds.hi);
+        }
+        return res;
+    }
+    bool empty() const override {
+        return !m_children || m_children->empty();
+    }
+    // Children have colours of their own.
+    bool transparent() const override {
+        return false;
+    }
+};
+#undef MIX
+
+class DrawableFactory final {
+public:
+    using Generator = std::function<std::shared_ptr<Drawable>(const Json &args)>;
+    DrawableFactory() {
+#define ITEM(name) m_generators[#name] = [] (const Json &args) {   return std::make_shared<name>(args);  }
+        ITEM(Rect);
+        ITEM(Curve);
+        ITEM(Line);
+        ITEM(Text);
+        ITEM(Circle);
+        ITEM(Ray);
+        ITEM(HalfPlane);
+        ITEM(Ellipse);
+        ITEM(Polyline);
+        ITEM(Polygon);
+        ITEM(Bezierline);
+        ITEM(RectArray);
+        ITEM(CircleArray);
+        ITEM(Group);
+        ITEM(Grid);
+#undef ITEM
+    }
+    Generator get(const std::string &type) const {
+        auto iter = m_generators.find(type);
+        if (iter == m_generators.cend())throw;
+        return iter->second;
+    }
+private:
+    std::map <std::string, Generator> m_generators;
+};
+
+// Spans in which a drawable lies outside canvas are hidden.
+std::vector<DrawableAnimation> loadAnimations(const DrawableFactory &factory, const Json &drawables, const Bounds &canvas) {
+    std::vector<DrawableAnimation> anis;
+    for (auto &&drawable : drawables) {
+        auto type = drawable["type"].get<std::string>();
+        auto gen = factory.get(type);
+        auto frames = drawable["frame"];
+        // Children are loaded once and shared by every keyframe of their group.
+        std::shared_ptr<const std::vector<DrawableAnimation>> children;
+        Bounds childBounds;
+        if (type == "Group" && drawable.count("children")) {
+            children = std::make_shared<const std::vector<DrawableAnimation>>(loadAnimations(factory, drawable["children"], Bounds::everywhere()));
+            for (auto &&child : *children)
+                for (auto &&frame : child.frames)
+                    childBounds.unite(frame.span);
+        }
+        std::shared_ptr<GridImage> image;
+        if (type == "Grid")
+            image = std::make_shared<GridImage>();
+        DrawableAnimation ani;
+        for (auto &&frame : frames) {
+            KeyFrame kframe;
+            float ts = frame["ts"].get<float>();
+            kframe.timeStamp = ts;
+            if (frame.count("mix_mode")) {
+                auto mixMode = frame["mix_mode"].get<std::string>();
+                kframe.mixMode = str2MixMode(mixMode);
+            }
+            else kframe.mixMode = MixMode::lerp;
+            kframe.drawable = gen(drawable);
+            kframe.drawable->loadParams(frame);
+            if (children)
+                std::static_pointer_cast<Group>(kframe.drawable)->setChildren(children, childBounds);
+            if (image)
+                std::static_pointer_cast<Grid>(kframe.drawable)->setImage(image);
+            ani.frames.push_back(kframe);
+        }
+        std::sort(ani.frames.begin(), ani.frames.end());
+        markHidden(ani, canvas);
+        anis.push_back(ani);
+    }
+    return anis;
+}
+
+/*
+A chunked scene is a manifest holding the usual scene header plus a "chunks" list of
+{ begin, end, file }. Each chunk file only holds the keyframes of its time window (plus
+one carry-in and one carry-out keyframe per drawable), so only the chunk being rendered
+and the one being prefetched are resident.
+*/
+struct Chunk final {
+    float begin, end;
+    fs::path file;
+};
+
+std::vector<DrawableAnimation> loadChunk(const DrawableFactory &factory, const fs::path &file, const Bounds &canvas) {
+    std::ifstream in(file);
+    Json json;
+    in >> json;
+    return loadAnimations(factory, json["drawables"], canvas);
+}
+
+/*
+The optional "camera" track pans and zooms on top of the fit of the virtual area to the video.
+Its keyframes hold "center" (in scene units) and "zoom" (1 shows the whole virtual area); the
+camera holds still before the first and after the last keyframe. Zoom is interpolated
+geometrically, so zooming in and out again take the same time.
+*/
+struct CameraKey final {
+    float timeStamp;
+    MixMode mixMode;
+    glm::vec2 center;
+    float zoom;
+    bool operator<(const CameraKey &rhs) const {
+        return timeStamp < rhs.timeStamp;
+    }
+};
+
+std::vector<CameraKey> loadCamera(const Json &track, glm::vec2 center) {
+    std::vector<CameraKey> keys;
+    for (auto &&frame : track) {
+        CameraKey key{ frame["ts"].get<float>(), MixMode::lerp, center, 1.0f };
+        if (frame.count("mix_mode"))
+            key.mixMode = str2MixMode(frame["mix_mode"].get<std::string>());
+        if (frame.count("center"))
+            key.center = parseVec2(frame["center"]);
+        if (frame.count("zoom"))
+            key.zoom = parseFloat(frame["zoom"]);
+        assert(key.zoom > 0.0f);
+        keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+CameraKey sampleCamera(const std::vector<CameraKey> &keys, float ct, glm::vec2 center) {
+    if (keys.empty())
+        return CameraKey{ ct, MixMode::lerp, center, 1.0f };
+    auto iter = std::lower_bound(keys.cbegin(), keys.cend(), CameraKey{ ct, MixMode::lerp, center, 1.0f });
+    if (iter == keys.cbegin())
+        return keys.front();
+    if (iter == keys.cend())
+        return keys.back();
+    auto prev = iter - 1;
+    auto delta = iter->timeStamp - prev->timeStamp;
+    if (delta <= 1e-5f)
+        return *iter;
+    auto u = applyMixFunc(iter->mixMode, (ct - prev->timeStamp) / delta);
+    return CameraKey{ ct, iter->mixMode, glm::mix(prev->center, iter->center, u), prev->zoom * std::pow(iter->zoom / prev->zoom, u) };
+}
+
+// Everything the camera can show. The edges of the view are concave (left, top) or convex (right,
+// bottom) in the mixing factor, so the views at the keyframes cover those in between.
+Bounds cameraCanvas(const std::vector<CameraKey> &keys, glm::vec2 size) {
+    Bounds res;
+    if (keys.empty()) {
+        res.extend({ 0.0f, 0.0f });
+        res.extend(size);
+    }
+    for (auto &&key : keys) {
+        glm::vec2 half = size * (0.5f / key.zoom);
+        res.extend(key.center - half);
+        res.extend(key.center + half);
+    }
+    return res;
+}
+
 int main(int argc, char **argv) {
     cxxopts::Options options("Renderer", "Algorithm Renderer");
 
@@ -626,30 +1443,28 @@ int main(int argc, char **argv) {
     dw *= scale; dh *= scale;
     glm::vec2 offset = { (width - dw) * 0.5f, (height - dh) * 0.5f };
 
+    auto camera = loadCamera(json.count("camera") ? json["camera"] : Json::array(), { odw * 0.5f, odh * 0.5f });
+    auto canvas = cameraCanvas(camera, { odw, odh });
+
     DrawableFactory factory;
-    auto drawables = json["drawables"];
+    std::vector<Chunk> chunks;
+    size_t curChunk = 0;
+    std::future<std::vector<DrawableAnimation>> nextChunk;
     std::vector<DrawableAnimation> anis;
-    for (auto &&drawable : drawables) {
-        auto type = drawable["type"].get<std::string>();
-        auto gen = factory.get(type);
-        auto frames = drawable["frame"];
-        DrawableAnimation ani;
-        for (auto &&frame : frames) {
-            KeyFrame kframe;
-            float ts = frame["ts"].get<float>();
-            kframe.timeStamp = ts;
-            if (frame.count("mix_mode")) {
-                auto mixMode = frame["mix_mode"].get<std::string>();
-                kframe.mixMode = str2MixMode(mixMode);
-            }
-            else kframe.mixMode = MixMode::lerp;
-            kframe.drawable = gen(drawable);
-            kframe.drawable->loadParams(frame);
-            ani.frames.push_back(kframe);
-        }
-        std::sort(ani.frames.begin(), ani.frames.end());
-        anis.push_back(ani);
+    auto prefetch = [&] (size_t idx) {
+        if (idx < chunks.size())
+            nextChunk = std::async(std::launch::async, loadChunk, std::cref(factory), chunks[idx].file, canvas);
+    };
+    if (json.count("chunks")) {
+        for (auto &&chunk : json["chunks"])
+            chunks.push_back(Chunk{ parseFloat(chunk["begin"]), parseFloat(chunk["end"]), input.parent_path() / chunk["file"].get<std::string>() });
+        assert(!chunks.empty());
+        anis = loadChunk(factory, chunks[0].file, canvas);
+        prefetch(1);
     }
+    else anis = loadAnimations(factory, json["drawables"], canvas);
+    json.clear();
+    Schedule schedule(anis);
 
     GLFWwindow *window;
     if (!glfwInit())
@@ -677,6 +1492,12 @@ int main(int argc, char **argv) {
     //std::cout << "Backend:" << writer.getBackendName() << std::endl;
 
     for (float ct = 0.0f; ct < endTime; ct += step) {
+        while (curChunk + 1 < chunks.size() && ct >= chunks[curChunk].end) {
+            anis = nextChunk.get();
+            schedule = Schedule(anis);
+            prefetch(++curChunk + 1);
+        }
+
         glClearColor(back.r, back.g, back.b, back.a);
         glClearStencil(0);
         glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -698,25 +1519,19 @@ int main(int argc, char **argv) {
         nvgTranslate(ctx, offset.x, offset.y);
         nvgScale(ctx, scale, scale);
 
-        std::vector<std::shared_ptr<Drawable>> toDraw;
-        for (auto &&ani : anis) {
-            auto &&frames = ani.frames;
-            auto iter = std::lower_bound(frames.cbegin(), frames.cend(), KeyFrame{ ct, MixMode::lerp, nullptr });
-            if (iter == frames.cbegin() || iter == frames.cend())
-                continue;
-            auto prev = iter - 1;
-            auto delta = iter->timeStamp - prev->timeStamp;
-            if (delta > 1e-5f) {
-                auto u = (ct - prev->timeStamp) / delta;
-                toDraw.push_back(mix(prev->drawable, iter->drawable, applyMixFunc(iter->mixMode, u)));
-            }
-            else toDraw.push_back(iter->drawable);
-        }
-
-        std::sort(toDraw.begin(), toDraw.end(), [] (const std::shared_ptr<Drawable> &lhs, const std::shared_ptr<Drawable> &rhs) {
-            return *lhs < *rhs;
-            });
+        auto cam = sampleCamera(camera, ct, { odw * 0.5f, odh * 0.5f });
+        nvgTranslate(ctx, odw * 0.5f, odh * 0.5f);
+        nvgScale(ctx, cam.zoom, cam.zoom);
+        nvgTranslate(ctx, -cam.center.x, -cam.center.y);
+        glm::vec2 half = glm::vec2{ odw, odh } * (0.5f / cam.zoom);
+        Bounds view;
+        view.extend(cam.center - half);
+        view.extend(cam.center + half);
 
+        std::vector<std::shared_ptr<Drawable>> toDraw;
+        for (auto i : schedule.advance(ct))
+            sampleAnimation(anis[i], ct, view, toDraw);
+        sortByLayer(toDraw);
         for (auto &&item : toDraw)
             item->draw(ctx, odw, odh);
 
@@ -741,6 +1556,9 @@ int main(int argc, char **argv) {
     }
 
     writer.release();
+    // Grids release their images with the animations.
+    anis.clear();
+    nextChunk = {};
     nvgDeleteGL3(ctx);
     glfwTerminate();
     return 0;
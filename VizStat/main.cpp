@@ -0,0 +1,226 @@
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <functional>
+#pragma warning(push,0)
+#include <cxxopts.hpp>
+#pragma warning(pop)
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using Json = nlohmann::json;
+
+float timeStamp(const Json &frame) {
+    return frame["ts"].get<float>();
+}
+
+float optFloat(const Json &frame, const char *key) {
+    return frame.count(key) ? frame[key].get<float>() : -1.0f;
+}
+
+// What drawing one keyframe submits to NanoVG: path vertices and text glyphs.
+struct Work final {
+    size_t verts, glyphs;
+};
+
+Work estimateWork(const std::string &type, const Json &drawable, const Json &frame) {
+    auto arrows = [&] (const char *beg, const char *end) {
+        return (optFloat(frame, beg) > 0.0f ? 3 : 0) + (optFloat(frame, end) > 0.0f ? 3 : 0);
+    };
+    if (type == "Rect")
+        return { 4, 0 };
+    if (type == "Line")
+        return { 2u + arrows("beg_arrow", "end_arrow"), 0 };
+    if (type == "Curve")
+        return { 3u + arrows("beg_arrow", "end_arrow"), 0 };
+    if (type == "Circle" || type == "Ellipse")
+        return { 4, 0 };
+    if (type == "RectArray")
+        return { frame.count("pos") ? frame["pos"].size() * 2 : 0, 0 };
+    if (type == "CircleArray")
+        return { frame.count("radius") ? frame["radius"].size() * 4 : 0, 0 };
+    if (type == "Grid") {
+        // One textured rect, the cell borders unless filled, and the labels.
+        size_t verts = 4, glyphs = 0;
+        if (!drawable.count("fill") || !drawable["fill"].get<bool>())
+            verts += 2 * (frame["rows"].get<size_t>() + frame["cols"].get<size_t>() + 2);
+        if (frame.count("labels"))
+            for (auto &&label : frame["labels"])
+                glyphs += label.get<std::string>().size();
+        return { verts, glyphs };
+    }
+    if (type == "Ray")
+        return { 5, 0 };
+    if (type == "HalfPlane")
+        return { 2, 0 };
+    if (type == "Polyline" || type == "Polygon" || type == "Bezierline")
+        return { frame.count("verts") ? frame["verts"].size() : 0, 0 };
+    if (type == "Text") {
+        size_t glyphs = 0;
+        auto &&text = frame["text"];
+        if (text.is_array()) {
+            for (auto &&line : text)
+                glyphs += line.get<std::string>().size();
+        }
+        else glyphs = text.get<std::string>().size();
+        return { 0, glyphs };
+    }
+    return { 0, 0 };
+}
+
+struct FrameStat final {
+    float ts;
+    size_t active, verts, glyphs;
+    double cost;
+};
+
+int main(int argc, char **argv) {
+    cxxopts::Options options("vizstat", "Scene statistics and render-cost estimator");
+
+    options.add_options()("input", "input scene", cxxopts::value<std::string>())
+        ("rate", "frame rate", cxxopts::value<float>()->default_value("30"))
+        ("bins", "histogram bins", cxxopts::value<size_t>()->default_value("20"))
+        ("top", "number of longest frames to list", cxxopts::value<size_t>()->default_value("10"))
+        ("cost-drawable", "estimated microseconds per drawn drawable", cxxopts::value<double>()->default_value("2"))
+        ("cost-vertex", "estimated microseconds per path vertex", cxxopts::value<double>()->default_value("0.1"))
+        ("cost-glyph", "estimated microseconds per text glyph", cxxopts::value<double>()->default_value("0.5"));
+
+    auto result = options.parse(argc, argv);
+    fs::path input = result["input"].as<std::string>();
+    float rate = result["rate"].as<float>();
+    float step = 1.0f / rate;
+    size_t bins = std::max<size_t>(1, result["bins"].as<size_t>());
+    size_t top = result["top"].as<size_t>();
+    double costDrawable = result["cost-drawable"].as<double>();
+    double costVertex = result["cost-vertex"].as<double>();
+    double costGlyph = result["cost-glyph"].as<double>();
+
+    std::ifstream in(input);
+    Json json;
+    in >> json;
+    float endTime = json["duration"].get<float>();
+
+    // The renderer's frame clock, accumulated the same way.
+    std::vector<FrameStat> stats;
+    for (float ct = 0.0f; ct < endTime; ct += step)
+        stats.push_back(FrameStat{ ct, 0, 0, 0, 0.0 });
+
+    std::map<std::string, size_t> drawableCount, frameCount;
+    // Children of a group are counted like any other drawable; the group itself only saves and restores the transform.
+    std::function<void(const Json &)> account = [&] (const Json &drawable) {
+        auto type = drawable["type"].get<std::string>();
+        ++drawableCount[type];
+        if (drawable.count("children"))
+            for (auto &&child : drawable["children"])
+                account(child);
+        if (!drawable.count("frame") || !drawable["frame"].is_array())
+            return;
+
+        std::vector<const Json *> frames;
+        for (auto &&frame : drawable["frame"])
+            frames.push_back(&frame);
+        frameCount[type] += frames.size();
+        if (frames.size() < 2)
+            return;
+        std::stable_sort(frames.begin(), frames.end(), [] (const Json *lhs, const Json *rhs) {
+            return timeStamp(*lhs) < timeStamp(*rhs);
+            });
+
+        std::vector<Work> work;
+        for (auto &&frame : frames)
+            work.push_back(estimateWork(type, drawable, *frame));
+
+        // Drawn while first.ts < ct <= last.ts, with roughly the work of the keyframe it leaves.
+        float first = timeStamp(*frames.front()), last = timeStamp(*frames.back());
+        auto beg = std::upper_bound(stats.begin(), stats.end(), first, [] (float ts, const FrameStat &st) {return ts < st.ts; });
+        size_t next = 0;
+        for (auto iter = beg; iter != stats.end() && iter->ts <= last; ++iter) {
+            while (timeStamp(*frames[next]) < iter->ts)
+                ++next;
+            auto &&w = work[next - 1];
+            ++iter->active;
+            iter->verts += w.verts;
+            iter->glyphs += w.glyphs;
+        }
+    };
+    for (auto &&drawable : json["drawables"])
+        account(drawable);
+
+    for (auto &&st : stats)
+        st.cost = costDrawable * st.active + costVertex * st.verts + costGlyph * st.glyphs;
+
+    size_t totalDrawables = 0, totalFrames = 0;
+    std::cout << "drawables by type (keyframes):" << std::endl;
+    for (auto &&item : drawableCount) {
+        std::cout << "  " << std::setw(12) << std::left << item.first << std::right << std::setw(10) << item.second
+            << " (" << frameCount[item.first] << ")" << std::endl;
+        totalDrawables += item.second;
+        totalFrames += frameCount[item.first];
+    }
+    std::cout << "  " << std::setw(12) << std::left << "total" << std::right << std::setw(10) << totalDrawables
+        << " (" << totalFrames << ")" << std::endl;
+
+    if (stats.empty())
+        return 0;
+
+    size_t maxActive = 0;
+    double totalCost = 0.0;
+    size_t totalVerts = 0, totalGlyphs = 0;
+    for (auto &&st : stats) {
+        maxActive = std::max(maxActive, st.active);
+        totalCost += st.cost;
+        totalVerts += st.verts;
+        totalGlyphs += st.glyphs;
+    }
+
+    std::cout << std::endl << "active drawables over time (" << stats.size() << " frames, peak " << maxActive << "):" << std::endl;
+    constexpr size_t barWidth = 50;
+    for (size_t b = 0; b < bins; ++b) {
+        size_t lo = stats.size() * b / bins, hi = stats.size() * (b + 1) / bins;
+        if (lo == hi)
+            continue;
+        size_t peak = 0;
+        for (size_t i = lo; i < hi; ++i)
+            peak = std::max(peak, stats[i].active);
+        size_t len = maxActive ? barWidth * peak / maxActive : 0;
+        std::cout << "  " << std::fixed << std::setprecision(2) << std::setw(9) << stats[lo].ts << "s "
+            << std::setw(8) << peak << " " << std::string(len, '#') << std::endl;
+    }
+
+    std::cout << std::endl << "per frame: " << std::setprecision(1)
+        << static_cast<double>(totalVerts) / stats.size() << " path vertices, "
+        << static_cast<double>(totalGlyphs) / stats.size() << " glyphs on average" << std::endl;
+
+    std::vector<const FrameStat *> order;
+    for (auto &&st : stats)
+        order.push_back(&st);
+    top = std::min(top, order.size());
+    std::partial_sort(order.begin(), order.begin() + top, order.end(), [] (const FrameStat *lhs, const FrameStat *rhs) {
+        return lhs->cost > rhs->cost;
+        });
+    std::cout << std::endl << "longest frames:" << std::endl;
+    for (size_t i = 0; i < top; ++i) {
+        auto &&st = *order[i];
+        std::cout << "  " << std::setprecision(2) << std::setw(9) << st.ts << "s " << std::setprecision(3) << std::setw(10) << st.cost / 1000.0 << "ms  "
+            << st.active << " drawables, " << st.verts << " vertices, " << st.glyphs << " glyphs" << std::endl;
+    }
+
+    double worstSecond = 0.0;
+    size_t perSecond = std::max<size_t>(1, static_cast<size_t>(std::lround(rate)));
+    for (size_t i = 0; i < stats.size(); i += perSecond) {
+        double cost = 0.0;
+        for (size_t j = i; j < std::min(stats.size(), i + perSecond); ++j)
+            cost += stats[j].cost;
+        worstSecond = std::max(worstSecond, cost);
+    }
+    std::cout << std::endl << "estimated render cost per second of output: " << std::setprecision(3)
+        << totalCost / 1000.0 / endTime << "ms average, " << worstSecond / 1000.0 << "ms worst" << std::endl;
+    std::cout << "estimated total: " << totalCost / 1e6 << "s for " << endTime << "s of output" << std::endl;
+    return 0;
+}